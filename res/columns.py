@@ -0,0 +1,102 @@
+import numpy as np
+
+# The byte order of a file from the order mark after its magic, the files
+# are written in the byte order of the machine which ran the simulation.
+def _order(f, magic, what):
+    head = f.read(16)
+    if head[:8].rstrip(b"\0") != magic:
+        raise ValueError(f.name + " is not " + what)
+    if head[8:] == bytes(range(8, 0, -1)):
+        return "<"
+    if head[8:] == bytes(range(1, 9)):
+        return ">"
+    raise ValueError(f.name + " has no byte order mark")
+
+
+def _names(f, order, count):
+    names = []
+    for _ in range(count):
+        length = int(np.frombuffer(f.read(4), dtype=order + "u4")[0])
+        names.append(f.read(length).decode())
+    return names
+
+
+# Load the binary columns written with -f f64 or -f f32. Nothing is read
+# until it is used: every column is a numpy.memmap of its block of the file,
+# so a slice only touches the pages it covers. The columns are in the order
+# of the file, the same global can be emitted by several systems.
+#
+#   data = load("lorenz.bin")
+#   plt.plot(data["time"], data["columns"][data["names"].index("x")])
+def load(path):
+    with open(path, "rb") as f:
+        order = _order(f, b"ODECOL2", "a columnar simulation output")
+        header = np.dtype([("itemSize", order + "u4"), ("columns", order + "u4"),
+                           ("rows", order + "u8"), ("data", order + "u8")])
+        head = np.frombuffer(f.read(header.itemsize), dtype=header)[0]
+        names = _names(f, order, int(head["columns"]))
+
+    rows = int(head["rows"])
+    offset = int(head["data"])
+    item = order + ("f8" if head["itemSize"] == 8 else "f4")
+    time = np.memmap(path, dtype=order + "f8", mode="r", offset=offset, shape=(rows,))
+    offset += rows * 8
+    columns = []
+    for _ in names:
+        columns.append(np.memmap(path, dtype=item, mode="r", offset=offset, shape=(rows,)))
+        offset += rows * int(head["itemSize"])
+    return {"time": time, "names": names, "columns": columns}
+
+
+# Load the level of detail pyramid written with -z. Every level holds the
+# time of the first row of each block and, per column in the order of the
+# names, a memmap of the minimum, maximum and mean of each block.
+def load_lod(path):
+    with open(path, "rb") as f:
+        order = _order(f, b"ODELOD2", "a level of detail pyramid")
+        header = np.dtype([("block", order + "u4"), ("columns", order + "u4"),
+                           ("rows", order + "u8"), ("levels", order + "u8"), ("data", order + "u8")])
+        head = np.frombuffer(f.read(header.itemsize), dtype=header)[0]
+        names = _names(f, order, int(head["columns"]))
+
+    rows = int(head["rows"])
+    offset = int(head["data"])
+    span = int(head["block"])
+    levels = []
+    for _ in range(int(head["levels"])):
+        entries = -(-rows // span)
+        level = {"span": span, "time": np.memmap(path, dtype=order + "f8", mode="r", offset=offset, shape=(entries,))}
+        offset += entries * 8
+        level["columns"] = []
+        for _ in names:
+            level["columns"].append(np.memmap(path, dtype=order + "f8", mode="r", offset=offset, shape=(entries, 3)))
+            offset += entries * 24
+        levels.append(level)
+        span *= 2
+    return {"rows": rows, "names": names, "levels": levels}
+
+
+# The envelope of a column from time t0 to t1 in at most pixels parts, read from
+# the coarsest level with at least a block per pixel: the times and the
+# minimum, maximum and mean of each part.
+#
+#   lod = load_lod("lorenz.lod")
+#   t, lo, hi, mean = envelope(lod, lod["names"].index("x"), 0, 35, 800)
+#   plt.fill_between(t, lo, hi)
+def envelope(lod, column, t0, t1, pixels):
+    levels = lod["levels"]
+    first = max(int(np.searchsorted(levels[0]["time"], t0, side="right")) - 1, 0)
+    last = max(int(np.searchsorted(levels[0]["time"], t1, side="right")), first + 1)
+    k = 0
+    while k + 1 < len(levels) and (last - first) >> (k + 1) >= pixels:
+        k += 1
+    level = levels[k]
+    a, b = first >> k, ((last - 1) >> k) + 1
+    blocks = np.asarray(level["columns"][column][a:b])
+    counts = np.minimum(level["span"], lod["rows"] - np.arange(a, b) * level["span"])
+    parts = min(pixels, b - a)
+    edges = (np.arange(parts + 1) * (b - a)) // parts
+    lo = np.minimum.reduceat(blocks[:, 0], edges[:-1])
+    hi = np.maximum.reduceat(blocks[:, 1], edges[:-1])
+    mean = np.add.reduceat(blocks[:, 2] * counts, edges[:-1]) / np.add.reduceat(counts, edges[:-1])
+    return np.asarray(level["time"][a:b])[edges[:-1]], lo, hi, mean
@@ -0,0 +1,52 @@
+import socket
+import struct
+import sys
+
+# Read the live stream of a simulation run with -w: the names of the columns,
+# then (sequence, time, values) for every frame until the last one. A gap in
+# the sequence numbers is the frames the viewer was too slow for.
+def frames(f):
+    def read(n):
+        data = b""
+        while len(data) < n:
+            part = f.read(n - len(data))
+            if not part:
+                raise EOFError
+            data += part
+        return data
+
+    magic, columns, size = struct.unpack("=8sII", read(16))
+    if magic != b"ODESTRM1":
+        raise ValueError("not a simulation stream")
+    names = []
+    for _ in range(columns):
+        (length,) = struct.unpack("=I", read(4))
+        names.append(read(length).decode())
+    yield names
+    frame = struct.Struct("=Qd%dd" % columns)
+    while True:
+        sequence, time, *values = frame.unpack(read(size))
+        if sequence == 2**64 - 1:
+            return
+        yield sequence, time, values
+
+
+# python3 stream.py <fifo>, or python3 stream.py -l <socket> to listen on a
+# Unix domain socket before the simulation starts, or the stream on stdin
+if __name__ == "__main__":
+    if len(sys.argv) > 2 and sys.argv[1] == "-l":
+        server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        server.bind(sys.argv[2])
+        server.listen(1)
+        source = server.accept()[0].makefile("rb")
+    elif len(sys.argv) > 1:
+        source = open(sys.argv[1], "rb")
+    else:
+        source = sys.stdin.buffer
+    stream = frames(source)
+    print("sequence,time," + ",".join(next(stream)))
+    try:
+        for sequence, time, values in stream:
+            print(sequence, time, *values, sep=",")
+    except EOFError:
+        pass
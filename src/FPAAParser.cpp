@@ -11,10 +11,11 @@
 #include "include/odeSystem.h"
 
 //Function which parses the ODE-system into an FPAA config
-void ODESystem::parseFPAAOutput() {
+void ODESystem::parseFPAAOutput(const bool d) {
 	std::string name = "FPAAres/" + systemName + ".FPAAconfig";
 	std::ofstream outputFile(name);
 	int c = 0;
+	CABCount count = {0, 0};
 	
 	std::vector<var> constants;
 	std::vector<var> variables;
@@ -26,11 +27,15 @@ void ODESystem::parseFPAAOutput() {
 		for (size_t i = 0; i < o.varValues.size(); i += 1) {
 			if (o.varValues[i]->isInteg()) {
 				outputFile << "#FPAA Config for expression of variable " << o.varNames[i] << "\nFPAASystem_" << c << " {\n";
-				o.varValues[i]->FPAAPrintConfig(outputFile, c, constants, variables, globals, o.varNames[i]);
+				o.varValues[i]->FPAAPrintConfig(outputFile, c, constants, variables, globals, o.varNames[i], count);
 				outputFile << "};\n\n";
 				c += 1;
 			}
 		} 
 	}
 	outputFile.close();
+	if (d) {
+		std::cerr << "FPAA: " << count.emitted << " CABs emitted for " << count.tree << " operations, "
+							<< count.tree - count.emitted << " saved by folding and sharing\n";
+	}
 }
\ No newline at end of file
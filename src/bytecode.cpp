@@ -0,0 +1,233 @@
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+
+#include "include/expression.h"
+#include "include/bytecode.h"
+
+/*
+*		Lower the tree to bytecode, the variables have to be bound with resolve
+*		first. The scaling of literals and loads is baked into the instructions
+*		so the interpreter does not branch on rho.
+*		Constants do not change while simulating, so they are loaded as literals
+*		and subtrees of literals are folded. Folding computes exactly what the
+*		interpreter would, in the same order, so results stay bit for bit equal
+*/
+void Expr::compile(const std::vector<var>& constants,
+									 const std::vector<var>& vars,
+									 const std::vector<global_var>& global) {
+	code.clear();
+	stack.clear();
+	if (root == NONODE) return;
+
+	const Node& r = (*arena)[root];
+	NodeId start = (r.op == NodeType::INTEG) ? r.right : root;
+	emitCode(start, rho != 0.0, 0, constants, vars, global);
+}
+
+static double fold(OpCode op, double a, double b) {
+	switch (op) {
+	case OpCode::ADD:
+		return a + b;
+	case OpCode::SUB:
+		return a - b;
+	case OpCode::MUL:
+		return a * b;
+	default:
+		return a / b;
+	}
+}
+
+void Expr::emitCode(NodeId id, bool scaled, size_t depth,
+										const std::vector<var>& constants,
+										const std::vector<var>& vars,
+										const std::vector<global_var>& global) {
+	if (stack.size() < depth + 1) {
+		stack.resize(depth + 1);
+	}
+	if (id == NONODE) {
+		code.push_back(Instr{OpCode::PUSH, 0, 0.0, 0.0});
+		return;
+	}
+
+	const Node& n = (*arena)[id];
+	if (n.op == NodeType::NUM) {
+		double v = scaled ? ((n.value / rho) + delta) : n.value;
+		code.push_back(Instr{OpCode::PUSH, 0, v, 0.0});
+		return;
+	}
+	if (n.op == NodeType::VAR) {
+		switch (n.kind) {
+		case SlotKind::CONSTANT: {
+			const var& c = constants[n.slot];
+			double v = scaled ? ((c.value / c.rho) + c.delta) : c.value;
+			code.push_back(Instr{OpCode::PUSH, 0, v, 0.0});
+			break;
+		}
+		case SlotKind::LOCAL:
+			if (scaled) {
+				const var& v = vars[n.slot];
+				code.push_back(Instr{OpCode::LOADL_S, n.slot, v.rho, v.delta});
+			}
+			else {
+				code.push_back(Instr{OpCode::LOADL, n.slot, 0.0, 0.0});
+			}
+			break;
+		case SlotKind::GLOBAL:
+			if (scaled) {
+				const global_var& g = global[n.slot];
+				code.push_back(Instr{OpCode::LOADG_S, n.slot, g.rho, g.delta});
+			}
+			else {
+				code.push_back(Instr{OpCode::LOADG, n.slot, 0.0, 0.0});
+			}
+			break;
+		default:
+			code.push_back(Instr{OpCode::FAIL, VARNOTFOUND, 0.0, 0.0});
+			break;
+		}
+		return;
+	}
+	if (n.op == NodeType::WAVE && (n.oper == 's' || n.oper == 'c')) {
+		size_t start = code.size();
+		emitCode(n.right, scaled, depth, constants, vars, global);
+		if (code.size() - start == 1 && code[start].op == OpCode::PUSH) {
+			code[start].a = (n.oper == 's') ? std::sin(code[start].a) : std::cos(code[start].a);
+			return;
+		}
+		code.push_back(Instr{n.oper == 's' ? OpCode::SIN : OpCode::COS, 0, 0.0, 0.0});
+		return;
+	}
+
+	OpCode op;
+	switch (n.oper) {
+	case '+':
+		op = OpCode::ADD;
+		break;
+	case '-':
+		op = OpCode::SUB;
+		break;
+	case '*':
+		op = OpCode::MUL;
+		break;
+	case '/':
+		op = OpCode::DIV;
+		break;
+	default:
+		op = OpCode::FAIL;
+		break;
+	}
+
+	size_t leftStart = code.size();
+	emitCode(n.left, scaled, depth, constants, vars, global);
+	size_t rightStart = code.size();
+	emitCode(n.right, scaled, depth + 1, constants, vars, global);
+
+	if (op == OpCode::FAIL) {
+		code.push_back(Instr{OpCode::FAIL, OPNOTFOUND, 0.0, 0.0});
+		return;
+	}
+
+	bool leftConst = (rightStart - leftStart == 1 && code[leftStart].op == OpCode::PUSH);
+	bool rightConst = (code.size() - rightStart == 1 && code[rightStart].op == OpCode::PUSH);
+	if (leftConst && rightConst) {
+		double a = code[leftStart].a;
+		double b = code[rightStart].a;
+		//a division by zero is left to fail when evaluated
+		if (op != OpCode::DIV || b != 0.0) {
+			code.pop_back();
+			code.back().a = fold(op, a, b);
+			return;
+		}
+	}
+	//identities which hold exactly for every x
+	if (rightConst) {
+		double b = code[rightStart].a;
+		if (((op == OpCode::MUL || op == OpCode::DIV) && b == 1.0) || (op == OpCode::SUB && b == 0.0 && !std::signbit(b))) {
+			code.pop_back();
+			return;
+		}
+	}
+	if (leftConst && op == OpCode::MUL && code[leftStart].a == 1.0) {
+		code.erase(code.begin() + leftStart);
+		return;
+	}
+	code.push_back(Instr{op, 0, 0.0, 0.0});
+}
+
+
+/*
+*		Run the bytecode, the context has to hold the value arrays it was
+*		compiled against
+*/
+double Expr::EvaluateCode(const EvalContext& ctx) {
+	const double* constants = ctx.constants.value.data();
+	const double* locals = ctx.locals.value.data();
+	const double* globals = ctx.globals->value.data();
+	double* sp = stack.data();
+
+	for (const Instr& in : code) {
+		switch (in.op) {
+		case OpCode::PUSH:
+			*sp++ = in.a;
+			break;
+		case OpCode::LOADC:
+			*sp++ = constants[in.slot];
+			break;
+		case OpCode::LOADC_S:
+			*sp++ = (constants[in.slot] / in.a) + in.b;
+			break;
+		case OpCode::LOADL:
+			*sp++ = locals[in.slot];
+			break;
+		case OpCode::LOADG:
+			*sp++ = globals[in.slot];
+			break;
+		case OpCode::LOADL_S:
+			*sp++ = (locals[in.slot] / in.a) + in.b;
+			break;
+		case OpCode::LOADG_S:
+			*sp++ = (globals[in.slot] / in.a) + in.b;
+			break;
+		case OpCode::ADD:
+			sp -= 1;
+			sp[-1] = sp[-1] + sp[0];
+			break;
+		case OpCode::SUB:
+			sp -= 1;
+			sp[-1] = sp[-1] - sp[0];
+			break;
+		case OpCode::MUL:
+			sp -= 1;
+			sp[-1] = sp[-1] * sp[0];
+			break;
+		case OpCode::DIV:
+			sp -= 1;
+			if (sp[0] == 0.0) {
+				throw std::invalid_argument("Division by 0 not possible\n");
+			}
+			sp[-1] = sp[-1] / sp[0];
+			break;
+		case OpCode::SIN:
+			sp[-1] = std::sin(sp[-1]);
+			break;
+		case OpCode::COS:
+			sp[-1] = std::cos(sp[-1]);
+			break;
+		case OpCode::FAIL:
+			if (in.slot == VARNOTFOUND) {
+				throw std::invalid_argument("Variable not found\n");
+			}
+			throw std::invalid_argument("Operation not found\n");
+		}
+	}
+
+	if (rho != 0.0) {
+		return (stack[0] - delta) / rho;
+	}
+	return stack[0];
+}
+
+size_t Expr::codeSize() {
+	return code.size();
+}
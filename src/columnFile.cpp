@@ -0,0 +1,450 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "include/columnFile.h"
+#include "include/constants.h"
+
+static const char MAGIC[8] = {'O', 'D', 'E', 'C', 'O', 'L', '2', '\0'};
+static const char LODMAGIC[8] = {'O', 'D', 'E', 'L', 'O', 'D', '2', '\0'};
+//written as a number, its bytes show the byte order of the file
+static const uint64_t ORDER = 0x0102030405060708ULL;
+
+//pwrite until all of it is written
+static bool writeAt(int fd, const void* p, size_t n, uint64_t offset) {
+	const char* c = static_cast<const char*>(p);
+	while (n > 0) {
+		ssize_t w = pwrite(fd, c, n, offset);
+		if (w <= 0) {
+			return false;
+		}
+		c += w;
+		n -= w;
+		offset += w;
+	}
+	return true;
+}
+
+//room for a header of size bytes followed by the names, padded to COLUMNALIGN
+static std::vector<char> withNames(size_t size, const std::vector<std::string>& names) {
+	std::vector<char> head(size);
+	for (const auto& name : names) {
+		uint32_t length = name.size();
+		head.insert(head.end(), reinterpret_cast<const char*>(&length), reinterpret_cast<const char*>(&length) + sizeof(length));
+		head.insert(head.end(), name.begin(), name.end());
+	}
+	head.resize((head.size() + COLUMNALIGN - 1) / COLUMNALIGN * COLUMNALIGN, '\0');
+	return head;
+}
+
+//count names from at, false when they run into the data
+static bool readNames(std::string_view view, size_t at, size_t count, uint64_t data, std::vector<std::string>& names) {
+	for (size_t c = 0; c < count; c += 1) {
+		uint32_t length;
+		if (at + sizeof(length) > data) {
+			return false;
+		}
+		std::memcpy(&length, view.data() + at, sizeof(length));
+		at += sizeof(length);
+		if (length > data - at) {
+			return false;
+		}
+		names.emplace_back(view.data() + at, length);
+		at += length;
+	}
+	return true;
+}
+
+/*
+*		Write the header and the names and size the file for all rows, the
+*		blocks are filled in as the rows come
+*/
+bool ColumnWriter::open(const std::string& path, const std::vector<std::string>& names, size_t rows, size_t itemSize) {
+	close();
+	if (itemSize != sizeof(double) && itemSize != sizeof(float)) {
+		return false;
+	}
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	this->itemSize = itemSize;
+	this->rows = rows;
+	columns = names.size();
+
+	std::vector<char> head = withNames(sizeof(ColumnHeader), names);
+	data = head.size();
+	ColumnHeader header;
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.order = ORDER;
+	header.itemSize = itemSize;
+	header.columns = columns;
+	header.rows = rows;
+	header.data = data;
+	std::memcpy(head.data(), &header, sizeof(header));
+
+	bytes = data + rows * sizeof(double) + columns * rows * itemSize;
+	written = 0;
+	buffered = 0;
+	failed = !writeAt(fd, head.data(), head.size(), 0) || ftruncate(fd, bytes) != 0;
+
+	blockRows = std::max<size_t>(1, COLUMNBUF / ((columns + 1) * sizeof(double)));
+	times.resize(blockRows);
+	block.resize(blockRows * columns);
+	if (itemSize == sizeof(float)) {
+		narrow.resize(blockRows);
+	}
+	return true;
+}
+
+void ColumnWriter::row(double time, const double* values) {
+	if (written + buffered == rows) {
+		return;
+	}
+	times[buffered] = time;
+	for (size_t c = 0; c < columns; c += 1) {
+		block[c * blockRows + buffered] = values[c];
+	}
+	buffered += 1;
+	if (buffered == blockRows) {
+		flush();
+	}
+}
+
+/*
+*		Write the buffered rows into the blocks of their columns
+*/
+bool ColumnWriter::flush() {
+	if (buffered == 0) {
+		return !failed;
+	}
+	uint64_t offset = data + written * sizeof(double);
+	failed = failed || !writeAt(fd, times.data(), buffered * sizeof(double), offset);
+	for (size_t c = 0; c < columns && !failed; c += 1) {
+		offset = data + rows * sizeof(double) + (c * rows + written) * itemSize;
+		const double* values = block.data() + c * blockRows;
+		if (itemSize == sizeof(float)) {
+			std::copy(values, values + buffered, narrow.begin());
+			failed = !writeAt(fd, narrow.data(), buffered * sizeof(float), offset);
+		}
+		else {
+			failed = !writeAt(fd, values, buffered * sizeof(double), offset);
+		}
+	}
+	written += buffered;
+	buffered = 0;
+	return !failed;
+}
+
+/*
+*		Write what is left, false when a write failed
+*/
+bool ColumnWriter::close() {
+	if (fd < 0) {
+		return !failed;
+	}
+	flush();
+	failed = ::close(fd) != 0 || failed;
+	fd = -1;
+	return !failed;
+}
+
+bool ColumnReader::open(const std::string& path) {
+	names.clear();
+	base = nullptr;
+	if (!file.open(path)) {
+		return false;
+	}
+	std::string_view view = file.view();
+	if (view.size() < sizeof(ColumnHeader)) {
+		return false;
+	}
+	std::memcpy(&header, view.data(), sizeof(header));
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.order != ORDER ||
+			(header.itemSize != sizeof(double) && header.itemSize != sizeof(float)) ||
+			header.data % COLUMNALIGN != 0 || header.data > view.size()) {
+		return false;
+	}
+	//the blocks must fit, checked without overflowing
+	const uint64_t room = view.size() - header.data;
+	const uint64_t perRow = sizeof(double) + uint64_t(header.columns) * header.itemSize;
+	if (header.rows > room / perRow) {
+		return false;
+	}
+
+	if (!readNames(view, sizeof(ColumnHeader), header.columns, header.data, names)) {
+		return false;
+	}
+	base = view.data() + header.data;
+	return true;
+}
+
+size_t ColumnReader::find(const std::string& name) const {
+	return std::find(names.begin(), names.end(), name) - names.begin();
+}
+
+const double* ColumnReader::time() const {
+	return reinterpret_cast<const double*>(base);
+}
+
+const double* ColumnReader::f64(size_t column) const {
+	if (base == nullptr || header.itemSize != sizeof(double) || column >= header.columns) {
+		return nullptr;
+	}
+	return reinterpret_cast<const double*>(base + header.rows * sizeof(double) + column * header.rows * sizeof(double));
+}
+
+const float* ColumnReader::f32(size_t column) const {
+	if (base == nullptr || header.itemSize != sizeof(float) || column >= header.columns) {
+		return nullptr;
+	}
+	return reinterpret_cast<const float*>(base + header.rows * sizeof(double) + column * header.rows * sizeof(float));
+}
+
+std::vector<double> ColumnReader::read(size_t column, size_t first, size_t count) const {
+	if (first > header.rows) {
+		first = header.rows;
+	}
+	count = std::min<size_t>(count, header.rows - first);
+	if (const double* v = f64(column)) {
+		return std::vector<double>(v + first, v + first + count);
+	}
+	if (const float* v = f32(column)) {
+		return std::vector<double>(v + first, v + first + count);
+	}
+	return {};
+}
+
+/*
+*		Write the header and the names and size the file for every level, the
+*		blocks of a level are buffered in proportion to how often they complete
+*/
+bool LodWriter::open(const std::string& path, const std::vector<std::string>& names, size_t rows) {
+	close();
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	columns = names.size();
+	this->rows = rows;
+	std::vector<char> head = withNames(sizeof(LodHeader), names);
+
+	levels.clear();
+	const size_t base = std::max<size_t>(1, COLUMNBUF / ((3 * columns + 1) * sizeof(double)));
+	uint64_t offset = head.size();
+	for (size_t span = LODBLOCK; rows > 0; span *= 2) {
+		Level level;
+		level.span = span;
+		level.entries = (rows + span - 1) / span;
+		level.offset = offset;
+		level.count = 0;
+		level.time = 0.0;
+		level.acc.resize(3 * columns);
+		level.written = 0;
+		level.buffered = 0;
+		level.capacity = std::min(level.entries, std::max<size_t>(1, base >> levels.size()));
+		level.times.resize(level.capacity);
+		level.block.resize(3 * columns * level.capacity);
+		offset += level.entries * (1 + 3 * columns) * sizeof(double);
+		levels.push_back(std::move(level));
+		if (levels.back().entries == 1) {
+			break;
+		}
+	}
+
+	LodHeader header;
+	std::memcpy(header.magic, LODMAGIC, sizeof(LODMAGIC));
+	header.order = ORDER;
+	header.block = LODBLOCK;
+	header.columns = columns;
+	header.rows = rows;
+	header.levels = levels.size();
+	header.data = head.size();
+	std::memcpy(head.data(), &header, sizeof(header));
+	failed = !writeAt(fd, head.data(), head.size(), 0) || ftruncate(fd, offset) != 0;
+	single.resize(3 * columns);
+	return true;
+}
+
+void LodWriter::row(double time, const double* values) {
+	if (levels.empty()) {
+		return;
+	}
+	for (size_t c = 0; c < columns; c += 1) {
+		single[3 * c] = single[3 * c + 1] = single[3 * c + 2] = values[c];
+	}
+	add(0, time, single.data(), 1);
+}
+
+/*
+*		Sum count rows into the block of level k, acc holds the minimum, maximum
+*		and sum of each column over them
+*/
+void LodWriter::add(size_t k, double time, const double* acc, size_t count) {
+	Level& l = levels[k];
+	if (l.written + l.buffered == l.entries) {
+		return;
+	}
+	if (l.count == 0) {
+		l.time = time;
+		std::copy(acc, acc + 3 * columns, l.acc.begin());
+	}
+	else {
+		for (size_t c = 0; c < columns; c += 1) {
+			l.acc[3 * c] = std::min(l.acc[3 * c], acc[3 * c]);
+			l.acc[3 * c + 1] = std::max(l.acc[3 * c + 1], acc[3 * c + 1]);
+			l.acc[3 * c + 2] += acc[3 * c + 2];
+		}
+	}
+	l.count += count;
+	if (l.count == l.span) {
+		complete(k);
+	}
+}
+
+/*
+*		Buffer the block of level k and add it to the level above
+*/
+void LodWriter::complete(size_t k) {
+	Level& l = levels[k];
+	l.times[l.buffered] = l.time;
+	for (size_t c = 0; c < columns; c += 1) {
+		double* out = l.block.data() + 3 * (c * l.capacity + l.buffered);
+		out[0] = l.acc[3 * c];
+		out[1] = l.acc[3 * c + 1];
+		out[2] = l.acc[3 * c + 2] / l.count;
+	}
+	l.buffered += 1;
+	if (k + 1 < levels.size()) {
+		add(k + 1, l.time, l.acc.data(), l.count);
+	}
+	l.count = 0;
+	if (l.buffered == l.capacity) {
+		flush(k);
+	}
+}
+
+void LodWriter::flush(size_t k) {
+	Level& l = levels[k];
+	if (l.buffered == 0 || failed) {
+		l.written += l.buffered;
+		l.buffered = 0;
+		return;
+	}
+	failed = !writeAt(fd, l.times.data(), l.buffered * sizeof(double), l.offset + l.written * sizeof(double));
+	for (size_t c = 0; c < columns && !failed; c += 1) {
+		uint64_t offset = l.offset + l.entries * sizeof(double) + 3 * (c * l.entries + l.written) * sizeof(double);
+		failed = !writeAt(fd, l.block.data() + 3 * c * l.capacity, 3 * l.buffered * sizeof(double), offset);
+	}
+	l.written += l.buffered;
+	l.buffered = 0;
+}
+
+/*
+*		Complete the last blocks, which hold fewer rows, from the bottom up
+*/
+bool LodWriter::close() {
+	if (fd < 0) {
+		return !failed;
+	}
+	for (size_t k = 0; k < levels.size(); k += 1) {
+		if (levels[k].count > 0) {
+			complete(k);
+		}
+		flush(k);
+	}
+	failed = ::close(fd) != 0 || failed;
+	fd = -1;
+	return !failed;
+}
+
+bool LodReader::open(const std::string& path) {
+	names.clear();
+	entries.clear();
+	times.clear();
+	blocks.clear();
+	if (!file.open(path)) {
+		return false;
+	}
+	std::string_view view = file.view();
+	if (view.size() < sizeof(LodHeader)) {
+		return false;
+	}
+	std::memcpy(&header, view.data(), sizeof(header));
+	if (std::memcmp(header.magic, LODMAGIC, sizeof(LODMAGIC)) != 0 || header.order != ORDER || header.block == 0 || header.levels > 64 ||
+			header.data % COLUMNALIGN != 0 || header.data > view.size()) {
+		return false;
+	}
+	if (!readNames(view, sizeof(LodHeader), header.columns, header.data, names)) {
+		return false;
+	}
+
+	//every level must fit, checked without overflowing
+	const uint64_t perEntry = (1 + 3 * uint64_t(header.columns)) * sizeof(double);
+	uint64_t offset = header.data;
+	uint64_t span = header.block;
+	for (uint64_t k = 0; k < header.levels; k += 1) {
+		const uint64_t n = header.rows / span + (header.rows % span != 0);
+		if (n > (view.size() - offset) / perEntry) {
+			return false;
+		}
+		entries.push_back(n);
+		times.push_back(reinterpret_cast<const double*>(view.data() + offset));
+		blocks.push_back(reinterpret_cast<const double*>(view.data() + offset + n * sizeof(double)));
+		offset += n * perEntry;
+		span *= 2;
+	}
+	return true;
+}
+
+size_t LodReader::find(const std::string& name) const {
+	return std::find(names.begin(), names.end(), name) - names.begin();
+}
+
+/*
+*		The blocks of level 0 overlapping the window are found by their times,
+*		the level is the coarsest with at least a block per pixel, so every
+*		pixel merges only a few blocks whatever the length of the window
+*/
+std::vector<Envelope> LodReader::query(size_t column, double t0, double t1, size_t pixels) const {
+	std::vector<Envelope> res;
+	if (column >= header.columns || pixels == 0 || entries.empty()) {
+		return res;
+	}
+	const double* t = times[0];
+	size_t first = std::upper_bound(t, t + entries[0], t0) - t;
+	first = first > 0 ? first - 1 : 0;
+	size_t last = std::upper_bound(t, t + entries[0], t1) - t;
+	last = std::max(last, first + 1);
+
+	size_t k = 0;
+	while (k + 1 < entries.size() && ((last - first) >> (k + 1)) >= pixels) {
+		k += 1;
+	}
+	const size_t a = first >> k;
+	const size_t b = ((last - 1) >> k) + 1;
+	const size_t parts = std::min(pixels, b - a);
+	const uint64_t span = uint64_t(header.block) << k;
+	const double* v = blocks[k] + 3 * column * entries[k];
+	for (size_t p = 0; p < parts; p += 1) {
+		const size_t from = a + (b - a) * p / parts;
+		const size_t to = a + (b - a) * (p + 1) / parts;
+		Envelope e{times[k][from], v[3 * from], v[3 * from + 1], 0.0};
+		double sum = 0.0;
+		uint64_t count = 0;
+		for (size_t j = from; j < to; j += 1) {
+			e.min = std::min(e.min, v[3 * j]);
+			e.max = std::max(e.max, v[3 * j + 1]);
+			const uint64_t n = std::min<uint64_t>(span, header.rows - j * span);
+			sum += v[3 * j + 2] * n;
+			count += n;
+		}
+		e.mean = sum / count;
+		res.push_back(e);
+	}
+	return res;
+}
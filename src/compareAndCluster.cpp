@@ -10,45 +10,45 @@
 
 #include "include/odeSystem.h"
 
-int ODESystem::editTreeDistance(const Node* root1, const Node* root2) {
-	if (root1 == nullptr) {
-		if (root2) {
-			if (!root2->left && !root2->right) {
+int ODESystem::editTreeDistance(const NodeArena& nodes, NodeId root1, NodeId root2) {
+	if (root1 == NONODE) {
+		if (root2 != NONODE) {
+			const Node& r2 = nodes[root2];
+			if (r2.left == NONODE && r2.right == NONODE) {
 				return 0;
 			}
-			return 1 + editTreeDistance(nullptr, root2->left) + editTreeDistance(nullptr, root2->right);
+			return 1 + editTreeDistance(nodes, NONODE, r2.left) + editTreeDistance(nodes, NONODE, r2.right);
 		}
 		return 0;
 	}
-	if (root2 == nullptr) {
-		if (root1) {
-			if (!root1->left && !root1->right) {
-				return 0;
-			}
-			return 1 + editTreeDistance(root1->left, nullptr) + editTreeDistance(root1->right, nullptr);
+	const Node& r1 = nodes[root1];
+	if (root2 == NONODE) {
+		if (r1.left == NONODE && r1.right == NONODE) {
+			return 0;
 		}
-		return 0;
+		return 1 + editTreeDistance(nodes, r1.left, NONODE) + editTreeDistance(nodes, r1.right, NONODE);
 	}
+	const Node& r2 = nodes[root2];
 
-	if (!root1->left && !root2->right && !root2->left && !root2->right) {
+	if (r1.left == NONODE && r2.right == NONODE && r2.left == NONODE && r2.right == NONODE) {
 		return 0;
 	}
-	if (!root1->left && !root1->right) {
-		return editTreeDistance(nullptr, root2);
+	if (r1.left == NONODE && r1.right == NONODE) {
+		return editTreeDistance(nodes, NONODE, root2);
 	}
-	if (!root2->left && !root2->right) {
-		return editTreeDistance(root1, nullptr);
+	if (r2.left == NONODE && r2.right == NONODE) {
+		return editTreeDistance(nodes, root1, NONODE);
 	}
 
 
-	int init = (root1->op == root2->op && root1->oper == root2->oper) ? 0 : 1;
+	int init = (r1.op == r2.op && r1.oper == r2.oper) ? 0 : 1;
 	
 	std::vector<int> minElement = {
-		1 + editTreeDistance(root1, root2->left),
-		1 + editTreeDistance(root1, root2->right),
-		1 + editTreeDistance(root1->left, root2),
-		1 + editTreeDistance(root1->right, root2),
-		init + editTreeDistance(root1->left, root2->left) + editTreeDistance(root1->right, root2->right)
+		1 + editTreeDistance(nodes, root1, r2.left),
+		1 + editTreeDistance(nodes, root1, r2.right),
+		1 + editTreeDistance(nodes, r1.left, root2),
+		1 + editTreeDistance(nodes, r1.right, root2),
+		init + editTreeDistance(nodes, r1.left, r2.left) + editTreeDistance(nodes, r1.right, r2.right)
 	};
 	std::vector<int>::iterator res = std::min_element(minElement.begin(), minElement.end());
 
@@ -61,7 +61,7 @@ std::vector<std::vector<int>> ODESystem::computeSimilarityMatrix(const std::vect
 	int distance;
 	for (size_t i = 0; i < vars.size(); i += 1) {
 		for (size_t j = i + 1; j < vars.size(); j += 1) {
-			distance = editTreeDistance(vars[i]->getRoot(), vars[j]->getRoot());
+			distance = editTreeDistance(*vars[i]->getArena(), vars[i]->getRoot(), vars[j]->getRoot());
 			matrix[i][j] = distance;
 			matrix[j][i] = distance;
 		}
@@ -85,7 +85,7 @@ std::pair<int, int> findMinPair(const std::vector<std::vector<int>> simMatrix) {
 	return minPair;
 }
 
-ODE ODESystem::cluster(ODE ode) {
+ODE ODESystem::cluster(ODE ode, std::ostream& log) {
 	std::vector<std::vector<int>> simMatrix = computeSimilarityMatrix(ode.varValues);
 
 	size_t n = ode.varValues.size();
@@ -97,9 +97,9 @@ ODE ODESystem::cluster(ODE ode) {
 
 	for (size_t i = 0; i < n; i += 1) {
 		for (size_t j = 0; j < n; j += 1) {
-			std::cerr << simMatrix[i][j] << ' ';
+			log << simMatrix[i][j] << ' ';
 		}
-		std::cerr << '\n';
+		log << '\n';
 	}
 
 	int cur = n;
@@ -157,6 +157,7 @@ ODE ODESystem::cluster(ODE ode) {
 	ret.varValues = reorderedExpr;
 	ret.interval = reorderedInterval;
 	ret.time = ode.time;
+	ret.emits = ode.emits;
 
 	return ret;
 }
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <charconv>
+#include <cstring>
+
+#include "include/csvWriter.h"
+#include "include/constants.h"
+
+//longest field to_chars writes, a double with 6 digits and its exponent
+constexpr size_t FIELDMAX = 32;
+
+CsvWriter::CsvWriter()
+	: used(0), backUsed(0), bytes(0), seconds(0.0), full(false), stop(false), failed(false) {}
+
+CsvWriter::~CsvWriter() {
+	close();
+}
+
+bool CsvWriter::open(const std::string& path) {
+	out.open(path, std::ios::binary);
+	if (!out.is_open()) {
+		return false;
+	}
+	front.resize(WRITEBUF);
+	back.resize(WRITEBUF);
+	used = 0;
+	bytes = 0;
+	full = false;
+	stop = false;
+	failed = false;
+	start = std::chrono::steady_clock::now();
+	writer = std::thread(&CsvWriter::run, this);
+	return true;
+}
+
+/*
+*		Write what is left and wait for the writer, false when a write failed
+*/
+bool CsvWriter::close() {
+	if (!writer.joinable()) {
+		return !failed;
+	}
+	flip();
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stop = true;
+	}
+	cv.notify_all();
+	writer.join();
+	out.close();
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return !failed;
+}
+
+/*
+*		Hand the front buffer to the writer once it has written the back one
+*/
+void CsvWriter::flip() {
+	std::unique_lock<std::mutex> lock(m);
+	cv.wait(lock, [&]() {
+		return !full;
+	});
+	std::swap(front, back);
+	backUsed = used;
+	bytes += used;
+	used = 0;
+	full = true;
+	cv.notify_all();
+}
+
+void CsvWriter::run() {
+	std::unique_lock<std::mutex> lock(m);
+	for (;;) {
+		cv.wait(lock, [&]() {
+			return full || stop;
+		});
+		if (full) {
+			lock.unlock();
+			out.write(back.data(), backUsed);
+			lock.lock();
+			failed = failed || !out;
+			full = false;
+			cv.notify_all();
+			continue;
+		}
+		return;
+	}
+}
+
+void CsvWriter::reserve(size_t n) {
+	if (used + n > front.size()) {
+		flip();
+		if (n > front.size()) {
+			front.resize(n);
+		}
+	}
+}
+
+/*
+*		%g with 6 digits, which is what an ostream writes by default
+*/
+void CsvWriter::field(double v) {
+	reserve(FIELDMAX);
+	char* p = front.data() + used;
+	p = std::to_chars(p, front.data() + front.size(), v, std::chars_format::general, 6).ptr;
+	*p++ = ',';
+	used = p - front.data();
+}
+
+void CsvWriter::field(size_t v) {
+	reserve(FIELDMAX);
+	char* p = front.data() + used;
+	p = std::to_chars(p, front.data() + front.size(), v).ptr;
+	*p++ = ',';
+	used = p - front.data();
+}
+
+void CsvWriter::field(std::string_view s) {
+	reserve(s.size() + 1);
+	std::memcpy(front.data() + used, s.data(), s.size());
+	used += s.size();
+	front[used++] = ',';
+}
+
+void CsvWriter::endRow() {
+	reserve(1);
+	front[used++] = '\n';
+}
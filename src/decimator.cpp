@@ -0,0 +1,103 @@
+#include <vector>
+
+#include "include/decimator.h"
+
+Decimator::Decimator(const std::vector<size_t>& columns, size_t width, size_t every, bool minMax)
+	: columns(columns), every(every), minMax(minMax), count(0), rows(0), times{0.0, 0.0}, out(nullptr) {
+	all = columns.size() == width;
+	for (size_t c = 0; all && c < columns.size(); c += 1) {
+		all = columns[c] == c;
+	}
+	picked.resize(2 * columns.size());
+	if (minMax) {
+		lo.resize(columns.size());
+		hi.resize(columns.size());
+		loAt.resize(columns.size());
+		hiAt.resize(columns.size());
+	}
+}
+
+/*
+*		Point out at the recorded values, all of them are passed through as they are
+*/
+void Decimator::select(const double* values) {
+	if (all) {
+		out = values;
+		return;
+	}
+	for (size_t c = 0; c < columns.size(); c += 1) {
+		picked[c] = values[columns[c]];
+	}
+	out = picked.data();
+}
+
+bool Decimator::add(double time, const double* values) {
+	if (!minMax) {
+		bool first = count == 0;
+		count = (count + 1 == every) ? 0 : count + 1;
+		if (!first) {
+			return false;
+		}
+		rows = 1;
+		times[0] = time;
+		select(values);
+		return true;
+	}
+
+	const size_t n = columns.size();
+	if (count == 0) {
+		times[0] = time;
+		for (size_t c = 0; c < n; c += 1) {
+			lo[c] = hi[c] = values[columns[c]];
+			loAt[c] = hiAt[c] = 0;
+		}
+	}
+	else {
+		for (size_t c = 0; c < n; c += 1) {
+			const double v = values[columns[c]];
+			if (v < lo[c]) {
+				lo[c] = v;
+				loAt[c] = count;
+			}
+			if (v > hi[c]) {
+				hi[c] = v;
+				hiAt[c] = count;
+			}
+		}
+	}
+	times[1] = time;
+	count += 1;
+	if (count < every) {
+		return false;
+	}
+	emit();
+	return true;
+}
+
+bool Decimator::finish() {
+	if (!minMax || count == 0) {
+		return false;
+	}
+	emit();
+	return true;
+}
+
+/*
+*		The two rows of an interval, each global's extremes in the order of their steps
+*/
+void Decimator::emit() {
+	const size_t n = columns.size();
+	for (size_t c = 0; c < n; c += 1) {
+		const bool loFirst = loAt[c] <= hiAt[c];
+		picked[c] = loFirst ? lo[c] : hi[c];
+		picked[n + c] = loFirst ? hi[c] : lo[c];
+	}
+	out = picked.data();
+	rows = 2;
+	count = 0;
+}
+
+size_t Decimator::outputRows(size_t steps) const {
+	size_t intervals = (steps + every - 1) / every;
+	return minMax ? 2 * intervals : intervals;
+}
@@ -5,10 +5,29 @@
 #include <tuple>
 #include <fstream>
 #include <unordered_map>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <filesystem>
 
+//without it ublas checks every LU factorisation of the stiff stepper by
+//multiplying the factors back, which costs more than the factorisation
+#define BOOST_UBLAS_NDEBUG
 #include <boost/numeric/odeint.hpp>
 
 #include "include/odeSystem.h"
+#include "include/systemCode.h"
+#include "include/nativeCode.h"
+#include "include/stepScheduler.h"
+#include "include/expmStepper.h"
+#include "include/csvWriter.h"
+#include "include/columnFile.h"
+#include "include/decimator.h"
+#include "include/streamSink.h"
+#include "include/threadPool.h"
 #include "include/constants.h"
 
 std::vector<var> ODESystem::extractConstants(const ODE& ode) const {
@@ -66,6 +85,259 @@ std::vector<global_var> ODESystem::extractGlobals() const {
 	return globals;
 }
 
+/*
+*	Bind the variables of every expression of ode to their index in the value
+*	arrays, a name is looked up in the constants first, then in the local vars
+*	and then in the globals, the first match wins. The expressions are then
+*	compiled to bytecode against these arrays
+*/
+void ODESystem::bindSymbols(const ODE& ode,
+														const std::vector<var>& constants,
+														const std::vector<var>& vars,
+														const std::vector<global_var>& global) {
+	std::vector<Slot> symbols(arena.nameCount(), Slot{SlotKind::NONE, 0});
+	auto bind = [&](const std::string& name, SlotKind kind, size_t index) {
+		uint32_t id = arena.find(name);
+		if (id != NONAME) {
+			symbols[id] = Slot{kind, static_cast<uint32_t>(index)};
+		}
+	};
+
+	for (size_t i = global.size(); i-- > 0;) {
+		bind(global[i].name, SlotKind::GLOBAL, i);
+	}
+	for (size_t i = vars.size(); i-- > 0;) {
+		bind(vars[i].name, SlotKind::LOCAL, i);
+	}
+	for (size_t i = constants.size(); i-- > 0;) {
+		bind(constants[i].name, SlotKind::CONSTANT, i);
+	}
+
+	for (auto& e : ode.varValues) {
+		e->resolve(symbols);
+		e->compile(constants, vars, global);
+	}
+}
+
+/*
+*	Time the right hand side of every system evaluated by walking the trees, by
+*	running the bytecode of each expression and by running the DAG of the
+*	system, at the initial values of the vars
+*/
+void ODESystem::benchmark(std::ostream& out) {
+	using clock = std::chrono::steady_clock;
+	auto global = extractGlobals();
+
+	for (size_t k = 0; k < ODES.size(); k += 1) {
+		auto constants = extractConstants(ODES[k]);
+		auto vars = extractVariables(ODES[k]);
+		auto varExpr = extractVariablesInteg(ODES[k]);
+		bindSymbols(ODES[k], constants, vars, global);
+		if (varExpr.empty()) continue;
+		SlotArray globals;
+		globals.assign(global);
+		EvalContext ctx(constants, vars, &globals);
+		SystemCode dag;
+		dag.build(varExpr, constants, vars, global);
+
+		size_t nodes = 0;
+		for (const auto& e : varExpr) {
+			nodes += e->codeSize();
+		}
+		size_t iters = std::max<size_t>(1, BENCHOPS / std::max<size_t>(1, nodes));
+
+		std::vector<double> treeRes(varExpr.size());
+		std::vector<double> codeRes(varExpr.size());
+		std::vector<double> dagRes(varExpr.size());
+		double treeTime;
+		double codeTime;
+		double dagTime;
+		try {
+			auto t0 = clock::now();
+			for (size_t it = 0; it < iters; it += 1) {
+				for (size_t i = 0; i < varExpr.size(); i += 1) {
+					treeRes[i] = varExpr[i]->EvaluateTree(ctx);
+				}
+			}
+			auto t1 = clock::now();
+			for (size_t it = 0; it < iters; it += 1) {
+				for (size_t i = 0; i < varExpr.size(); i += 1) {
+					codeRes[i] = varExpr[i]->EvaluateCode(ctx);
+				}
+			}
+			auto t2 = clock::now();
+			for (size_t it = 0; it < iters; it += 1) {
+				dag.run(ctx, dagRes);
+			}
+			auto t3 = clock::now();
+			treeTime = std::chrono::duration<double>(t1 - t0).count();
+			codeTime = std::chrono::duration<double>(t2 - t1).count();
+			dagTime = std::chrono::duration<double>(t3 - t2).count();
+		} catch (const std::invalid_argument &e) {
+			out << "System " << k << ": " << e.what();
+			continue;
+		}
+
+		out << "System " << k << ": " << varExpr.size() << " expressions, "
+				<< nodes << " instructions, " << iters << " RHS evaluations\n";
+		out << "  tree:     " << treeTime / iters * 1e9 << " ns/RHS\n";
+		out << "  bytecode: " << codeTime / iters * 1e9 << " ns/RHS ("
+				<< treeTime / codeTime << "x)\n";
+		out << "  DAG:      " << dagTime / iters * 1e9 << " ns/RHS ("
+				<< treeTime / dagTime << "x), " << dag.getTreeNodes() << " tree nodes in "
+				<< dag.getDagNodes() << " DAG nodes, " << dag.getSaved() << " saved\n";
+		if (treeRes != codeRes || treeRes != dagRes) {
+			out << "  warning: results differ\n";
+		}
+
+		//the Jacobian against central differences of the DAG
+		dag.buildJacobian();
+		//a row for every expression, a column for every local var
+		const size_t n = varExpr.size();
+		const size_t m = vars.size();
+		std::vector<double> jac;
+		std::vector<double> f(n);
+		size_t jacIters = std::max<size_t>(1, iters / 2);
+		auto t4 = clock::now();
+		try {
+			for (size_t it = 0; it < jacIters; it += 1) {
+				dag.runJacobian(ctx, f, jac);
+			}
+		} catch (const std::invalid_argument &e) {
+			out << "  Jacobian: " << e.what();
+			continue;
+		}
+		double jacTime = std::chrono::duration<double>(clock::now() - t4).count();
+
+		const auto& rows = dag.getJacRows();
+		const auto& cols = dag.getJacCols();
+		std::vector<double> dense(n * m, 0.0);
+		for (size_t i = 0; i < n; i += 1) {
+			for (size_t k = rows[i]; k < rows[i + 1]; k += 1) {
+				dense[i * m + cols[k]] = jac[k];
+			}
+		}
+		double err = 0.0;
+		std::vector<double> fp(n);
+		std::vector<double> fm(n);
+		try {
+			for (size_t j = 0; j < m; j += 1) {
+				double x = ctx.locals.value[j];
+				double h = 1e-6 * std::max(1.0, std::abs(x));
+				ctx.locals.value[j] = x + h;
+				dag.run(ctx, fp);
+				ctx.locals.value[j] = x - h;
+				dag.run(ctx, fm);
+				ctx.locals.value[j] = x;
+				for (size_t i = 0; i < n; i += 1) {
+					double fd = (fp[i] - fm[i]) / (2 * h);
+					err = std::max(err, std::abs(fd - dense[i * m + j]) / std::max(1.0, std::abs(fd)));
+				}
+			}
+		} catch (const std::invalid_argument &e) {
+			out << "  Jacobian: " << e.what();
+			continue;
+		}
+		out << "  Jacobian: " << dag.getJacNonZeros() << " of " << n * m << " entries, "
+				<< jacTime / jacIters * 1e9 << " ns/evaluation, " << err
+				<< " relative difference to central differences\n";
+
+		//an affine system as A x + b against the DAG
+		if (!dag.buildLinear()) {
+			continue;
+		}
+		std::vector<double> linRes(n);
+		double linTime;
+		try {
+			auto t5 = clock::now();
+			for (size_t it = 0; it < iters; it += 1) {
+				dag.run(ctx, linRes);
+			}
+			linTime = std::chrono::duration<double>(clock::now() - t5).count();
+		} catch (const std::invalid_argument &e) {
+			out << "  linear: " << e.what();
+			continue;
+		}
+		double linErr = 0.0;
+		for (size_t i = 0; i < n; i += 1) {
+			linErr = std::max(linErr, std::abs(linRes[i] - dagRes[i]) / std::max(1.0, std::abs(dagRes[i])));
+		}
+		out << "  linear:   " << linTime / iters * 1e9 << " ns/RHS ("
+				<< treeTime / linTime << "x), " << dag.getLinVals().size() << " entries in A, "
+				<< linErr << " relative difference to the DAG\n";
+	}
+
+	//sin and cos of the ensemble kernel against libm, the largest difference
+	//in units of the last place of the libm result
+	{
+		const size_t count = BENCHOPS / 100;
+		std::vector<double> args(count);
+		std::vector<double> lanes(count);
+		std::vector<double> libm(count);
+		for (size_t i = 0; i < count; i += 1) {
+			args[i] = std::ldexp(std::sin(i * 0.618034) * 0.5 + 0.5001, i % 20) * ((i & 1) ? -1.0 : 1.0);
+		}
+		for (const char oper : {'s', 'c'}) {
+			auto t0 = clock::now();
+			SystemCode::runWave(oper, args.data(), lanes.data(), count);
+			auto t1 = clock::now();
+			for (size_t i = 0; i < count; i += 1) {
+				libm[i] = (oper == 's') ? std::sin(args[i]) : std::cos(args[i]);
+			}
+			auto t2 = clock::now();
+			double ulps = 0.0;
+			for (size_t i = 0; i < count; i += 1) {
+				double ulp = std::nextafter(std::abs(libm[i]), INFINITY) - std::abs(libm[i]);
+				ulps = std::max(ulps, std::abs(lanes[i] - libm[i]) / ulp);
+			}
+			double laneTime = std::chrono::duration<double>(t1 - t0).count();
+			double libmTime = std::chrono::duration<double>(t2 - t1).count();
+			out << (oper == 's' ? "sin" : "cos") << " of " << count << " values up to 2^20\n";
+			out << "  libm:  " << libmTime / count * 1e9 << " ns/value\n";
+			out << "  lanes: " << laneTime / count * 1e9 << " ns/value ("
+					<< libmTime / laneTime << "x), " << ulps << " ulp from libm at most\n";
+		}
+	}
+
+	//the CSV output, rows as wide as the simulation writes them through an
+	//ostream and through the writer
+	const size_t width = global.size() + 1;
+	const size_t rows = BENCHOPS / 100;
+	const auto dir = std::filesystem::temp_directory_path();
+	const std::string streamPath = (dir / (systemName + "_stream.csv")).string();
+	const std::string writerPath = (dir / (systemName + "_writer.csv")).string();
+	auto t0 = clock::now();
+	{
+		std::ofstream stream(streamPath);
+		for (size_t r = 0; r < rows; r += 1) {
+			for (size_t c = 0; c < width; c += 1) {
+				stream << std::sin(r * 0.001 + c) * (c + 1) << ',';
+			}
+			stream << '\n';
+		}
+	}
+	double streamTime = std::chrono::duration<double>(clock::now() - t0).count();
+	CsvWriter writer;
+	auto t1 = clock::now();
+	if (writer.open(writerPath)) {
+		for (size_t r = 0; r < rows; r += 1) {
+			for (size_t c = 0; c < width; c += 1) {
+				writer.field(std::sin(r * 0.001 + c) * (c + 1));
+			}
+			writer.endRow();
+		}
+		writer.close();
+	}
+	double writerTime = std::chrono::duration<double>(clock::now() - t1).count();
+	std::error_code ec;
+	const size_t streamBytes = std::filesystem::file_size(streamPath, ec);
+	out << "CSV output: " << rows << " rows of " << width << " fields\n";
+	out << "  ostream: " << streamBytes / streamTime / 1e6 << " MB/s\n";
+	out << "  writer:  " << writer.getBytes() / writerTime / 1e6 << " MB/s ("
+			<< streamTime / writerTime << "x)\n";
+	std::filesystem::remove(streamPath, ec);
+	std::filesystem::remove(writerPath, ec);
+}
 
 /*
 *	Simulate the system of ODEs using the odeint library
@@ -73,56 +345,231 @@ std::vector<global_var> ODESystem::extractGlobals() const {
 
 class IntegrationObserver {
 public:
-    IntegrationObserver(std::ofstream& outfile) : output(outfile) {}
+    IntegrationObserver(CsvWriter& outfile) : output(outfile) {}
 
     template<typename State>
     void operator()(const State& x, double t) const {
         for (size_t i = 0; i < x.size(); i += 1) {
-            output << x[i] << ",";
+            output.field(x[i]);
         }
     }
 
 private:
-    std::ofstream& output;
+    CsvWriter& output;
 };
 
 struct ODEs {
-  const std::vector<Expr*>& expressions;
-  const std::vector<var>& constants;
-  std::vector<var>& variables;
-  std::vector<global_var>& globals;
+  SystemCode& code;
+  const NativeCode& native;
+  size_t system;
+  EvalContext& ctx;
 
-  ODEs(const std::vector<Expr*>& exprs, 
-    const std::vector<var>& consts,
-    std::vector<var>& vars,
-    std::vector<global_var>& global)
-    : expressions(exprs), constants(consts), variables(vars), globals(global) {}
+  ODEs(SystemCode& sc, const NativeCode& nc, size_t k, EvalContext& c)
+    : code(sc), native(nc), system(k), ctx(c) {}
 
   void operator()(const std::vector<double>& x, std::vector<double>& dxdt, const double /* t */) const {
 		for (size_t i = 0; i < x.size(); i += 1) {
-    	variables[i].value = x[i];
+    	ctx.locals.value[i] = x[i];
     } 
-    // Evaluate each expression in the system of ODEs
-    for (size_t i = 0; i < expressions.size(); ++i) {
-      // Evaluate the expression and assign the result to the corresponding dxdt element
-      dxdt[i] = expressions[i]->Evaluate(constants, variables, globals);
+    // Evaluate all expressions of the system, shared subterms once
+    if (native.isLoaded()) {
+      native.run(system, ctx, dxdt);
+    }
+    else {
+      code.run(ctx, dxdt);
+    }
+  }
+};
+
+/*
+*	The system and its Jacobian in the form the rosenbrock4 stepper of odeint
+*	takes, on ublas vectors
+*/
+typedef boost::numeric::ublas::vector<double> StiffState;
+typedef boost::numeric::ublas::matrix<double> StiffMatrix;
+
+struct StiffODEs {
+  SystemCode& code;
+  EvalContext& ctx;
+  std::vector<double>& f;
+
+  StiffODEs(SystemCode& sc, EvalContext& c, std::vector<double>& fx)
+    : code(sc), ctx(c), f(fx) {}
+
+  void operator()(const StiffState& x, StiffState& dxdt, const double /* t */) const {
+    std::copy(x.begin(), x.end(), ctx.locals.value.begin());
+    code.run(ctx, f);
+    std::copy(f.begin(), f.end(), dxdt.begin());
+  }
+};
+
+struct StiffJacobian {
+  SystemCode& code;
+  EvalContext& ctx;
+  std::vector<double>& f;
+  std::vector<double>& jac;
+
+  StiffJacobian(SystemCode& sc, EvalContext& c, std::vector<double>& fx, std::vector<double>& j)
+    : code(sc), ctx(c), f(fx), jac(j) {}
+
+  void operator()(const StiffState& x, StiffMatrix& J, const double /* t */, StiffState& dfdt) const {
+    std::copy(x.begin(), x.end(), ctx.locals.value.begin());
+    code.runJacobian(ctx, f, jac);
+    const auto& rows = code.getJacRows();
+    const auto& cols = code.getJacCols();
+    J.clear();
+    for (size_t i = 0; i + 1 < rows.size(); i += 1) {
+      for (size_t k = rows[i]; k < rows[i + 1]; k += 1) {
+        J(i, cols[k]) = jac[k];
+      }
     }
+    //the right hand side does not depend on the time
+    dfdt.clear();
   }
 };
 
-void ODESystem::simulate() {
+/*
+*	Estimate the spectral radius of the Jacobian at the state in ctx by power
+*	iteration, the growth of the norm over the last iterations converges to it
+*	for complex pairs too. n is the size of the state, the rows of vars which
+*	are not integrated are 0
+*/
+static double spectralRadius(SystemCode& code, EvalContext& ctx, size_t n) {
+  std::vector<double> f(n);
+  std::vector<double> jac;
+  code.buildJacobian();
+  code.runJacobian(ctx, f, jac);
+  const auto& rows = code.getJacRows();
+  const auto& cols = code.getJacCols();
+
+  std::vector<double> v(n, 1.0 / std::sqrt(static_cast<double>(n)));
+  std::vector<double> w(n);
+  double logGrowth = 0.0;
+  const size_t iters = 60;
+  for (size_t it = 0; it < iters; it += 1) {
+    std::fill(w.begin(), w.end(), 0.0);
+    for (size_t i = 0; i + 1 < rows.size(); i += 1) {
+      for (size_t k = rows[i]; k < rows[i + 1]; k += 1) {
+        w[i] += jac[k] * v[cols[k]];
+      }
+    }
+    double norm = 0.0;
+    for (double x : w) {
+      norm += x * x;
+    }
+    norm = std::sqrt(norm);
+    if (norm == 0.0) {
+      return 0.0;
+    }
+    if (it >= iters / 2) {
+      logGrowth += std::log(norm);
+    }
+    for (size_t i = 0; i < n; i += 1) {
+      v[i] = w[i] / norm;
+    }
+  }
+  return std::exp(logGrowth / (iters - iters / 2));
+}
+
+/*
+*	Simulate with a stepper with step size control and dense output, which
+*	steps as far as the error allows. The state at every STEPPER is
+*	interpolated and the globals are exchanged there, when a global a system
+*	reads has changed its stepper is restarted from that state, so no step
+*	uses a global from before the last exchange. system(i) gives the system
+*	the stepper of system i integrates, which reads the globals of its context
+*/
+template<class Stepper, class State, class System>
+static void simulateDense(std::vector<Stepper>& steppers,
+                          std::vector<State>& states,
+                          System system,
+                          std::vector<SystemCode>& codes,
+                          std::vector<EvalContext>& contexts,
+                          const std::vector<std::vector<std::pair<size_t, size_t>>>& emitSets,
+                          const std::vector<double>& times,
+                          StepScheduler& scheduler,
+                          ThreadPool* pool,
+                          const StepScheduler::Row& row,
+                          const char* name,
+                          const bool d) {
+  //the globals every system reads, with their values when it was started
+  std::vector<std::vector<uint32_t>> reads(codes.size());
+  std::vector<std::vector<double>> seen(codes.size());
+  std::vector<size_t> steps(codes.size(), 0);
+  std::vector<size_t> restarts(codes.size(), 0);
+  for (size_t i = 0; i < codes.size(); i += 1) {
+    if (!states[i].empty()) {
+      steppers[i].initialize(states[i], 0.0, STEPPER);
+    }
+    reads[i] = codes[i].globalsRead();
+    for (uint32_t g : reads[i]) {
+      seen[i].push_back(contexts[i].globals->value[g]);
+    }
+  }
+
+  auto step = [&](size_t i, size_t s, double* out) {
+    const double time = times[s];
+    SlotArray& globals = *contexts[i].globals;
+    if (!states[i].empty()) {
+      bool changed = false;
+      for (size_t g = 0; g < reads[i].size(); g += 1) {
+        if (globals.value[reads[i][g]] != seen[i][g]) {
+          seen[i][g] = globals.value[reads[i][g]];
+          changed = true;
+        }
+      }
+      if (changed && time > 0) {
+        steppers[i].initialize(states[i], time, std::min(steppers[i].current_time_step(), STEPPER));
+        restarts[i] += 1;
+      }
+      auto sys = system(i);
+      while (steppers[i].current_time() < time + STEPPER) {
+        steppers[i].do_step(sys);
+        steps[i] += 1;
+      }
+      steppers[i].calc_state(time + STEPPER, states[i]);
+      std::copy(states[i].begin(), states[i].end(), contexts[i].locals.value.begin());
+    }
+
+    for (const auto &e : emitSets[i]) {
+      globals.value[e.second] = contexts[i].locals.value[e.first];
+      *out++ = globals.value[e.second];
+    }
+  };
+  scheduler.run(pool, times.size(), step, row);
+
+  if (d) {
+    for (size_t i = 0; i < codes.size(); i += 1) {
+      std::cerr << "System " << i << ": " << steps[i] << " " << name << " steps, "
+                << restarts[i] << " restarts\n";
+    }
+  }
+}
+
+bool ODESystem::simulate(const bool d, const SimulationOptions& opts) {
   using namespace boost::numeric::odeint;
 
   std::vector<std::vector<double>> stateVectors;
-  std::vector<std::vector<var>> variableSets;
-  std::vector<std::vector<Expr*>> expressionSets;
-  std::vector<std::vector<var>> constantSets;
+  std::vector<SystemCode> codes(ODES.size());
+  std::vector<EvalContext> contexts;
+  //for every system the (local var, global) pairs written after each step
+  std::vector<std::vector<std::pair<size_t, size_t>>> emitSets;
   auto global = extractGlobals();
+  SlotArray globals;
+  globals.assign(global);
 
-  for (auto &it : ODES) {
+  for (size_t k = 0; k < ODES.size(); k += 1) {
+    auto& it = ODES[k];
     auto constants = extractConstants(it);
     auto vars = extractVariables(it);
     auto varExpr = extractVariablesInteg(it);
+    bindSymbols(it, constants, vars, global);
+    codes[k].build(varExpr, constants, vars, global);
+    if (d) {
+      std::cerr << "System " << k << ": " << codes[k].getTreeNodes() << " tree nodes merged into "
+                << codes[k].getDagNodes() << " DAG nodes, "
+                << codes[k].getSaved() << " saved\n";
+    }
 
     std::vector<double> x(vars.size());
     size_t id = 0;
@@ -130,40 +577,334 @@ void ODESystem::simulate() {
        x[id++] = i->getInit();
     }
 
-    stateVectors.push_back(x);
-    variableSets.push_back(vars);
-    expressionSets.push_back(varExpr);
-    constantSets.push_back(constants);
-  }
-  std::string outputFileName = "res/" + systemName + ".csv";
-  std::ofstream outputFile(outputFileName);
-  if (!outputFile.is_open()) {
-    std::cerr << "Can't open outputfile\n";
-    return;
-	}
+    std::vector<std::pair<size_t, size_t>> emits;
+    for (size_t v = 0; v < vars.size(); v += 1) {
+      for (size_t g = 0; g < global.size(); g += 1) {
+        if (global[g].local_name == vars[v].name) {
+          emits.emplace_back(v, g);
+        }
+      }
+    }
 
-	outputFile << "time,";
-	for (const auto& g : global) {
-		outputFile << g.name << ',';
-	} outputFile << '\n';
+    stateVectors.push_back(x);
+    contexts.emplace_back(constants, vars, &globals);
+    emitSets.push_back(emits);
 
-  auto stepper = runge_kutta4<std::vector<double>>();
+    //suggest the stiff stepper when rk4 would not be stable at the start
+    if (opts.method == Method::RK4 && !x.empty()) {
+      EvalContext& ctx = contexts.back();
+      std::copy(x.begin(), x.end(), ctx.locals.value.begin());
+      try {
+        double radius = spectralRadius(codes[k], ctx, x.size());
+        if (radius * STEPPER > RK4STABLE) {
+          std::cerr << "Warning: system " << k << " is stiff, its Jacobian has a spectral radius of about "
+                    << radius << " which rk4 with a step of " << STEPPER
+                    << " can not follow, consider -m rosenbrock\n";
+        }
+      } catch (const std::invalid_argument &e) {
+        if (d) {
+          std::cerr << "System " << k << ": stiffness check skipped: " << e.what();
+        }
+      }
+    }
+  }
 
+  NativeCode nativeCode;
+  if (opts.native && !nativeCode.load(codes, d)) {
+    std::cerr << "Warning: could not compile the native RHS, using the interpreter\n";
+  }
+  //an affine system evaluates its right hand side as A x + b, a large one in
+  //chunks, the native code evaluates it as a whole
+  size_t work = 0;
+  for (size_t k = 0; k < ODES.size(); k += 1) {
+    bool linear = codes[k].buildLinear();
+    //a system without integrated vars has no rows in A
+    if (d && linear && codes[k].getLinRows().size() > 1) {
+      std::cerr << "System " << k << ": linear, A has " << codes[k].getLinVals().size() << " entries\n";
+    }
+    size_t chunks = (nativeCode.isLoaded() || linear) ? 1 : codes[k].partition();
+    if (d && chunks > 1) {
+      std::cerr << "System " << k << ": right hand side split into " << chunks << " chunks of "
+                << codes[k].getChunkInstrCount() << " instructions\n";
+    }
+    work += chunks;
+  }
+  std::vector<double> times;
   for (double time = 0; time < ODES[0].time; time += STEPPER) {
-  	outputFile << time << ',';
-    for (size_t i = 0; i < ODES.size(); ++i) {
-      integrate_const(stepper, ODEs(expressionSets[i], constantSets[i], variableSets[i], global), stateVectors[i], time, time + STEPPER, STEPPER);
-    	
-    	for (const auto &v : variableSets[i]) {
-      	for (auto& g : global) {
-      		if (g.local_name == v.name) {
-      			g.value = v.value;
-      			outputFile << g.value << ',';
-      		}
-      	}
-      }
-    }
-    outputFile << '\n';
-  }
-  outputFile.close();
-}
\ No newline at end of file
+    times.push_back(time);
+  }
+
+  //a row holds the emits of the systems one after the other, a chosen global
+  //is recorded from the system which declares its emit
+  std::vector<std::string> emitNames;
+  std::vector<bool> declared;
+  for (size_t i = 0; i < ODES.size(); i += 1) {
+    for (const auto &e : emitSets[i]) {
+      const std::string& name = global[e.second].name;
+      emitNames.push_back(name);
+      declared.push_back(std::any_of(ODES[i].emits.begin(), ODES[i].emits.end(), [&](const auto& emit) {
+        return emit.second == name;
+      }));
+    }
+  }
+  const size_t width = emitNames.size();
+  std::vector<size_t> columns;
+  std::vector<std::string> names;
+  for (const auto& name : opts.signals) {
+    size_t k = 0;
+    while (k < width && !(declared[k] && emitNames[k] == name)) {
+      k += 1;
+    }
+    if (k == width) {
+      std::cerr << "Error: no system emits " << name << '\n';
+      return false;
+    }
+    columns.push_back(k);
+    names.push_back(name);
+  }
+  if (opts.signals.empty()) {
+    for (size_t k = 0; k < width; k += 1) {
+      columns.push_back(k);
+    }
+    names = emitNames;
+  }
+  const size_t every = std::max<long long>(1, std::llround(opts.interval / STEPPER));
+  const bool minMax = opts.minMax && every > 1;
+  Decimator decimator(columns, width, every, minMax);
+  if (d && (every > 1 || columns.size() < width)) {
+    std::cerr << "Recording " << columns.size() << " of " << width << " globals, "
+              << (minMax ? "the minimum and maximum of " : "one row of ") << "every " << every << " steps\n";
+  }
+
+  //the live view of the recorded rows, a target which is not a FIFO or a
+  //socket is refused before any file is truncated
+  StreamSink stream;
+  if (!opts.stream.empty() && !stream.open(opts.stream, names)) {
+    std::cerr << "Can't stream to " << opts.stream << '\n';
+    return false;
+  }
+  //the pyramid of the recorded rows for plotting them at any zoom, opened
+  //before the output so a failure leaves the output of an earlier run as it was
+  const std::string lodFileName = "res/" + systemName + ".lod";
+  LodWriter lodFile;
+  if (opts.lod && !lodFile.open(lodFileName, names, decimator.outputRows(times.size()))) {
+    std::cerr << "Can't open " << lodFileName << '\n';
+    return false;
+  }
+  //the binary columns are sized for all the rows up front
+  const bool columnar = opts.output != Output::CSV;
+  std::string outputFileName = "res/" + systemName + (columnar ? ".bin" : ".csv");
+  CsvWriter outputFile;
+  ColumnWriter columnFile;
+  if (columnar) {
+    if (!columnFile.open(outputFileName, names, decimator.outputRows(times.size()),
+                         opts.output == Output::F64 ? sizeof(double) : sizeof(float))) {
+      std::cerr << "Can't open outputfile\n";
+      return false;
+    }
+  }
+  else {
+    if (!outputFile.open(outputFileName)) {
+      std::cerr << "Can't open outputfile\n";
+      return false;
+    }
+    outputFile.field("time");
+    if (opts.signals.empty()) {
+      for (const auto& g : global) {
+        outputFile.field(g.name);
+      }
+    }
+    else {
+      for (const auto& name : names) {
+        outputFile.field(name);
+      }
+    }
+    outputFile.endRow();
+  }
+
+  //the systems are stepped in the order of their conflicts over the globals
+  std::vector<std::vector<uint32_t>> reads;
+  std::vector<std::vector<uint32_t>> writes;
+  std::vector<size_t> emitted;
+  for (size_t i = 0; i < ODES.size(); i += 1) {
+    reads.push_back(codes[i].globalsRead());
+    writes.emplace_back();
+    for (const auto &e : emitSets[i]) {
+      writes.back().push_back(e.second);
+    }
+    emitted.push_back(emitSets[i].size());
+  }
+  StepScheduler scheduler(reads, writes, emitted);
+  //when pipelined every system reads a copy of the globals of its own
+  std::vector<SlotArray> views;
+  if (opts.pipeline) {
+    views.assign(ODES.size(), globals);
+    std::vector<double*> values;
+    for (size_t i = 0; i < ODES.size(); i += 1) {
+      contexts[i].globals = &views[i];
+      values.push_back(views[i].value.data());
+    }
+    scheduler.pipeline(values);
+  }
+  size_t threads = opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, work);
+  const bool parallel = scheduler.isParallel() || work > ODES.size();
+  if (d) {
+    std::cerr << ODES.size() << " systems with " << scheduler.getConflicts() << " conflicts";
+    if (opts.pipeline) {
+      std::cerr << " pipelined over " << scheduler.getRings() << " rings";
+    }
+    std::cerr << ", " << (parallel ? threads : 1) << " threads\n";
+  }
+
+  auto write = [&]() {
+    for (size_t r = 0; r < decimator.getRows(); r += 1) {
+      const double* values = decimator.getValues(r);
+      if (opts.lod) {
+        lodFile.row(decimator.getTime(r), values);
+      }
+      if (!opts.stream.empty()) {
+        stream.row(decimator.getTime(r), values);
+      }
+      if (columnar) {
+        columnFile.row(decimator.getTime(r), values);
+        continue;
+      }
+      outputFile.field(decimator.getTime(r));
+      for (size_t k = 0; k < columns.size(); k += 1) {
+        outputFile.field(values[k]);
+      }
+      outputFile.endRow();
+    }
+  };
+  auto row = [&](size_t s, const double* values) {
+    if (decimator.add(times[s], values)) {
+      write();
+    }
+  };
+
+  //declared last so the workers are joined before anything they use goes away
+  std::unique_ptr<ThreadPool> pool;
+  if (threads > 1 && parallel) {
+    pool = std::make_unique<ThreadPool>(threads);
+  }
+  for (auto& code : codes) {
+    code.setPool(pool.get());
+  }
+
+  if (opts.method == Method::ROSENBROCK) {
+    //rosenbrock4 solves a linear system with the Jacobian every step, so it
+    //stays stable with steps far larger than the time constants of a stiff system
+    typedef result_of::make_dense_output<rosenbrock4<double>>::type Stepper;
+    std::vector<Stepper> steppers;
+    std::vector<StiffState> states;
+    std::vector<std::vector<double>> f(ODES.size());
+    std::vector<std::vector<double>> jac(ODES.size());
+    for (size_t i = 0; i < ODES.size(); i += 1) {
+      codes[i].buildJacobian();
+      f[i].resize(stateVectors[i].size());
+      states.emplace_back(stateVectors[i].size());
+      std::copy(stateVectors[i].begin(), stateVectors[i].end(), states.back().begin());
+      steppers.push_back(make_dense_output(opts.absTol, opts.relTol, rosenbrock4<double>()));
+    }
+    auto system = [&](size_t i) {
+      return std::make_pair(StiffODEs(codes[i], contexts[i], f[i]),
+                            StiffJacobian(codes[i], contexts[i], f[i], jac[i]));
+    };
+    simulateDense(steppers, states, system, codes, contexts, emitSets, times,
+                  scheduler, pool.get(), row, "rosenbrock", d);
+  }
+  else if (opts.method == Method::DOPRI5) {
+    typedef result_of::make_dense_output<runge_kutta_dopri5<std::vector<double>>>::type Stepper;
+    std::vector<Stepper> steppers;
+    for (size_t i = 0; i < ODES.size(); i += 1) {
+      steppers.push_back(make_dense_output(opts.absTol, opts.relTol, runge_kutta_dopri5<std::vector<double>>()));
+    }
+    auto system = [&](size_t i) {
+      return ODEs(codes[i], nativeCode, i, contexts[i]);
+    };
+    simulateDense(steppers, stateVectors, system, codes, contexts, emitSets, times,
+                  scheduler, pool.get(), row, "dopri5", d);
+  }
+  else if (opts.method == Method::EXPM) {
+    //an affine system steps exactly with its matrix exponential, any other with rk4
+    std::vector<ExpmStepper> exact(ODES.size());
+    std::vector<bool> isExact(ODES.size(), false);
+    std::vector<runge_kutta4<std::vector<double>>> steppers(ODES.size());
+    for (size_t i = 0; i < ODES.size(); i += 1) {
+      if (stateVectors[i].empty()) {
+        continue;
+      }
+      if (codes[i].isLinear() && stateVectors[i].size() <= EXPMSTATES) {
+        exact[i].init(codes[i].getLinRows(), codes[i].getLinCols(), codes[i].getLinVals(), STEPPER);
+        isExact[i] = true;
+      }
+      else {
+        std::cerr << "Warning: system " << i;
+        if (codes[i].isLinear()) {
+          std::cerr << " has more than " << EXPMSTATES << " integrated vars";
+        }
+        else {
+          std::cerr << " is not linear";
+        }
+        std::cerr << ", it is stepped with rk4\n";
+      }
+    }
+    auto step = [&](size_t i, size_t s, double* out) {
+      if (isExact[i]) {
+        exact[i].step(stateVectors[i], codes[i].offset(contexts[i]));
+        std::copy(stateVectors[i].begin(), stateVectors[i].end(), contexts[i].locals.value.begin());
+      }
+      else {
+        integrate_const(std::ref(steppers[i]), ODEs(codes[i], nativeCode, i, contexts[i]), stateVectors[i], times[s], times[s] + STEPPER, STEPPER);
+      }
+
+      SlotArray& globals = *contexts[i].globals;
+      for (const auto &e : emitSets[i]) {
+        globals.value[e.second] = contexts[i].locals.value[e.first];
+        *out++ = globals.value[e.second];
+      }
+    };
+    scheduler.run(pool.get(), times.size(), step, row);
+  }
+  else {
+    //one stepper per system, a stepper sizes its buffers for the first state it sees
+    std::vector<runge_kutta4<std::vector<double>>> steppers(ODES.size());
+    auto step = [&](size_t i, size_t s, double* out) {
+      integrate_const(std::ref(steppers[i]), ODEs(codes[i], nativeCode, i, contexts[i]), stateVectors[i], times[s], times[s] + STEPPER, STEPPER);
+
+      SlotArray& globals = *contexts[i].globals;
+      for (const auto &e : emitSets[i]) {
+        globals.value[e.second] = contexts[i].locals.value[e.first];
+        *out++ = globals.value[e.second];
+      }
+    };
+    scheduler.run(pool.get(), times.size(), step, row);
+  }
+  pool.reset();
+  if (decimator.finish()) {
+    write();
+  }
+  bool written = true;
+  if (!(columnar ? columnFile.close() : outputFile.close())) {
+    std::cerr << "Error: failed to write " << outputFileName << '\n';
+    written = false;
+  }
+  if (opts.lod && !lodFile.close()) {
+    std::cerr << "Error: failed to write " << lodFileName << '\n';
+    written = false;
+  }
+  stream.close();
+  if (d && !opts.stream.empty()) {
+    std::cerr << "Streamed " << stream.getSent() << " frames to " << opts.stream << ", dropped "
+              << stream.getDropped() << '\n';
+  }
+  if (d && columnar) {
+    std::cerr << "Wrote " << columnFile.getBytes() << " bytes to " << outputFileName << '\n';
+  }
+  else if (d) {
+    std::cerr << "Wrote " << outputFile.getBytes() << " bytes to " << outputFileName << " at "
+              << outputFile.getBytes() / outputFile.getSeconds() / 1e6 << " MB/s\n";
+  }
+  return written;
+}
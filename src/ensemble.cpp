@@ -0,0 +1,244 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <functional>
+
+#include <boost/numeric/odeint.hpp>
+
+#include "include/odeSystem.h"
+#include "include/systemCode.h"
+#include "include/csvWriter.h"
+#include "include/constants.h"
+
+/*
+*		Read a parameter table, a header of variable names followed by one row
+*		of values per member, separated by commas
+*/
+static bool readTable(const std::string& path,
+											std::vector<std::string>& names,
+											std::vector<std::vector<double>>& rows) {
+	std::ifstream in(path);
+	if (!in.is_open()) {
+		std::cerr << "Error: failed to open ensemble table " << path << '\n';
+		return false;
+	}
+
+	auto split = [](const std::string& line) {
+		std::vector<std::string> fields;
+		std::stringstream ss(line);
+		std::string f;
+		while (std::getline(ss, f, ',')) {
+			size_t b = f.find_first_not_of(" \t\r");
+			size_t e = f.find_last_not_of(" \t\r");
+			fields.push_back(b == std::string::npos ? "" : f.substr(b, e - b + 1));
+		}
+		return fields;
+	};
+
+	std::string line;
+	int lineNr = 0;
+	while (std::getline(in, line)) {
+		lineNr += 1;
+		if (line.find_first_not_of(" \t\r") == std::string::npos) {
+			continue;
+		}
+		std::vector<std::string> fields = split(line);
+		if (names.empty()) {
+			names = fields;
+			continue;
+		}
+		if (fields.size() != names.size()) {
+			std::cerr << "Error: " << path << ":" << lineNr << ": expected " << names.size()
+								<< " values, got " << fields.size() << '\n';
+			return false;
+		}
+		std::vector<double> row;
+		for (const auto& f : fields) {
+			size_t pos = 0;
+			try {
+				row.push_back(std::stod(f, &pos));
+			} catch (const std::exception&) {
+				pos = 0;
+			}
+			if (pos == 0 || pos != f.size()) {
+				std::cerr << "Error: " << path << ":" << lineNr << ": invalid number '" << f << "'\n";
+				return false;
+			}
+		}
+		rows.push_back(row);
+	}
+	if (rows.empty()) {
+		std::cerr << "Error: ensemble table " << path << " has no members\n";
+		return false;
+	}
+	return true;
+}
+
+struct EnsembleODEs {
+	SystemCode& code;
+	BatchContext& ctx;
+
+	EnsembleODEs(SystemCode& sc, BatchContext& c)
+		: code(sc), ctx(c) {}
+
+	void operator()(const std::vector<double>& x, std::vector<double>& dxdt, const double /* t */) const {
+		std::copy(x.begin(), x.end(), ctx.locals.begin());
+		code.runBatch(ctx, dxdt);
+	}
+};
+
+/*
+*	Simulate every row of the table as a member of an ensemble. A column sets
+*	the value of a constant, or the initial value of an integrated var, in
+*	every system which has it. All members are integrated together, each
+*	system keeps the slots of all members side by side so one run of its DAG
+*	evaluates the right hand side of the whole ensemble
+*/
+bool ODESystem::simulateEnsemble(const std::string& table, const bool d) {
+	using namespace boost::numeric::odeint;
+
+	std::vector<std::string> names;
+	std::vector<std::vector<double>> rows;
+	if (!readTable(table, names, rows)) {
+		return false;
+	}
+	const size_t members = rows.size();
+	//the padding lanes repeat the first member
+	const size_t n = (members + BATCHLANES - 1) / BATCHLANES * BATCHLANES;
+	auto member = [&](size_t lane) {
+		return lane < members ? lane : 0;
+	};
+
+	auto global = extractGlobals();
+	std::vector<double> globals(global.size() * n);
+	for (size_t g = 0; g < global.size(); g += 1) {
+		std::fill(globals.begin() + g * n, globals.begin() + (g + 1) * n, global[g].value);
+	}
+
+	std::vector<SystemCode> codes(ODES.size());
+	std::vector<BatchContext> contexts(ODES.size());
+	std::vector<std::vector<double>> stateVectors(ODES.size());
+	std::vector<std::vector<std::pair<size_t, size_t>>> emitSets(ODES.size());
+	std::vector<bool> used(names.size(), false);
+
+	for (size_t k = 0; k < ODES.size(); k += 1) {
+		auto& it = ODES[k];
+		auto constants = extractConstants(it);
+		auto vars = extractVariables(it);
+		auto varExpr = extractVariablesInteg(it);
+		bindSymbols(it, constants, vars, global);
+		codes[k].build(varExpr, constants, vars, global, false);
+
+		BatchContext& ctx = contexts[k];
+		ctx.lanes = n;
+		ctx.constants.resize(constants.size() * n);
+		ctx.locals.resize(vars.size() * n);
+		ctx.globals = &globals;
+
+		for (size_t c = 0; c < constants.size(); c += 1) {
+			std::fill(ctx.constants.begin() + c * n, ctx.constants.begin() + (c + 1) * n, constants[c].value);
+		}
+		std::vector<double>& x = stateVectors[k];
+		x.resize(vars.size() * n);
+		for (size_t v = 0; v < varExpr.size(); v += 1) {
+			std::fill(x.begin() + v * n, x.begin() + (v + 1) * n, varExpr[v]->getInit());
+		}
+
+		for (size_t col = 0; col < names.size(); col += 1) {
+			auto name = std::find(it.varNames.begin(), it.varNames.end(), names[col]);
+			if (name == it.varNames.end()) {
+				continue;
+			}
+			Expr* e = it.varValues[name - it.varNames.begin()];
+			double* dst = nullptr;
+			for (size_t c = 0; c < constants.size() && !dst; c += 1) {
+				if (constants[c].name == names[col]) {
+					dst = ctx.constants.data() + c * n;
+				}
+			}
+			for (size_t v = 0; v < varExpr.size() && !dst; v += 1) {
+				if (varExpr[v] == e) {
+					dst = x.data() + v * n;
+				}
+			}
+			if (!dst) {
+				continue;
+			}
+			used[col] = true;
+			for (size_t l = 0; l < n; l += 1) {
+				dst[l] = e->scaleInit(rows[member(l)][col]);
+			}
+		}
+
+		for (size_t v = 0; v < vars.size(); v += 1) {
+			for (size_t g = 0; g < global.size(); g += 1) {
+				if (global[g].local_name == vars[v].name) {
+					emitSets[k].emplace_back(v, g);
+				}
+			}
+		}
+		if (d) {
+			std::cerr << "System " << k << ": " << codes[k].getInstrCount() << " instructions over "
+								<< n << " lanes\n";
+		}
+	}
+
+	for (size_t col = 0; col < names.size(); col += 1) {
+		if (!used[col]) {
+			std::cerr << "Error: no system has a constant or integrated var " << names[col] << '\n';
+			return false;
+		}
+	}
+
+	std::string outputFileName = "res/" + systemName + "_ensemble.csv";
+	CsvWriter outputFile;
+	if (!outputFile.open(outputFileName)) {
+		std::cerr << "Can't open outputfile\n";
+		return false;
+	}
+
+	outputFile.field("member");
+	outputFile.field("time");
+	for (const auto& g : global) {
+		outputFile.field(g.name);
+	} outputFile.endRow();
+
+	std::vector<runge_kutta4<std::vector<double>>> steppers(ODES.size());
+	//the values of a step as they were emitted, a global can be emitted twice
+	size_t emitCount = 0;
+	for (const auto& e : emitSets) {
+		emitCount += e.size();
+	}
+	std::vector<double> emitted(emitCount * n);
+
+	for (double time = 0; time < ODES[0].time; time += STEPPER) {
+		size_t col = 0;
+		for (size_t i = 0; i < ODES.size(); ++i) {
+			integrate_const(std::ref(steppers[i]), EnsembleODEs(codes[i], contexts[i]), stateVectors[i], time, time + STEPPER, STEPPER);
+
+			for (const auto &e : emitSets[i]) {
+				auto src = contexts[i].locals.begin() + e.first * n;
+				std::copy(src, src + n, globals.begin() + e.second * n);
+				std::copy(src, src + n, emitted.begin() + col * n);
+				col += 1;
+			}
+		}
+		for (size_t m = 0; m < members; m += 1) {
+			outputFile.field(m);
+			outputFile.field(time);
+			for (size_t c = 0; c < emitCount; c += 1) {
+				outputFile.field(emitted[c * n + m]);
+			}
+			outputFile.endRow();
+		}
+	}
+	if (!outputFile.close()) {
+		std::cerr << "Error: failed to write " << outputFileName << '\n';
+		return false;
+	}
+	return true;
+}
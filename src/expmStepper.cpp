@@ -0,0 +1,110 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "include/expmStepper.h"
+
+//c = a * b for dense n by n matrices
+static void multiply(const std::vector<double>& a, const std::vector<double>& b, std::vector<double>& c, size_t n) {
+	std::fill(c.begin(), c.end(), 0.0);
+	for (size_t i = 0; i < n; i += 1) {
+		for (size_t k = 0; k < n; k += 1) {
+			const double aik = a[i * n + k];
+			if (aik == 0.0) {
+				continue;
+			}
+			for (size_t j = 0; j < n; j += 1) {
+				c[i * n + j] += aik * b[k * n + j];
+			}
+		}
+	}
+}
+
+/*
+*		Compute E and F for the step h. A h is halved s times until its norm is
+*		at most 1/2, where the Taylor series of both converge within a few terms,
+*		and the results are squared back with E(2h) = E(h) E(h) and
+*		F(2h) = F(h) + E(h) F(h). The terms of the series are products with the
+*		sparse A, only the squarings are dense
+*/
+void ExpmStepper::init(const std::vector<uint32_t>& rows,
+											 const std::vector<uint32_t>& cols,
+											 const std::vector<double>& vals,
+											 double h) {
+	n = rows.size() - 1;
+	next.resize(n);
+
+	//the norm of A h, the largest sum of magnitudes of a column
+	std::vector<double> colSum(n, 0.0);
+	for (size_t k = 0; k < cols.size(); k += 1) {
+		colSum[cols[k]] += std::fabs(vals[k]);
+	}
+	double norm = n > 0 ? h * *std::max_element(colSum.begin(), colSum.end()) : 0.0;
+	int s = 0;
+	while (norm > 0.5) {
+		norm /= 2.0;
+		s += 1;
+	}
+	const double hs = std::ldexp(h, -s);
+
+	//T = (A hs)^k / k!, E the sum of the T and F / hs the sum of T / (k + 1)
+	std::vector<double> T(n * n, 0.0);
+	std::vector<double> P(n * n);
+	E.assign(n * n, 0.0);
+	F.assign(n * n, 0.0);
+	for (size_t i = 0; i < n; i += 1) {
+		T[i * n + i] = 1.0;
+		E[i * n + i] = 1.0;
+		F[i * n + i] = 1.0;
+	}
+	for (int k = 1; k <= 30; k += 1) {
+		std::fill(P.begin(), P.end(), 0.0);
+		for (size_t i = 0; i < n; i += 1) {
+			for (size_t j = 0; j < n; j += 1) {
+				const double t = T[i * n + j];
+				if (t == 0.0) {
+					continue;
+				}
+				for (uint32_t e = rows[j]; e < rows[j + 1]; e += 1) {
+					P[i * n + cols[e]] += t * vals[e] * hs;
+				}
+			}
+		}
+		double largest = 0.0;
+		for (size_t i = 0; i < n * n; i += 1) {
+			T[i] = P[i] / k;
+			E[i] += T[i];
+			F[i] += T[i] / (k + 1);
+			largest = std::max(largest, std::fabs(T[i]));
+		}
+		if (largest < 1e-18) {
+			break;
+		}
+	}
+	for (auto& f : F) {
+		f *= hs;
+	}
+
+	for (int k = 0; k < s; k += 1) {
+		multiply(E, F, P, n);
+		for (size_t i = 0; i < n * n; i += 1) {
+			F[i] += P[i];
+		}
+		multiply(E, E, P, n);
+		E.swap(P);
+	}
+}
+
+/*
+*		x = E x + F b
+*/
+void ExpmStepper::step(std::vector<double>& x, const std::vector<double>& b) {
+	for (size_t i = 0; i < n; i += 1) {
+		double s = 0.0;
+		for (size_t j = 0; j < n; j += 1) {
+			s += E[i * n + j] * x[j] + F[i * n + j] * b[j];
+		}
+		next[i] = s;
+	}
+	std::copy(next.begin(), next.end(), x.begin());
+}
@@ -2,130 +2,138 @@
 #include <string>
 #include <vector>
 #include <cctype>
-#include <stack>
 #include <algorithm>
 #include <unordered_map>
-#include <regex>
 #include <cmath>
 #include <fstream>
+#include <string_view>
+#include <charconv>
+#include <cstring>
 
 #include "include/expression.h"
 #include "include/constants.h"
+#include "include/lexer.h"
 
-void Expr::print() {
-	printTree(root);
+void Expr::print(std::ostream& os) {
+	printTree(os, root);
 }
 
-void Expr::printTree(Node* r) {
-	if (r == nullptr) return;
+void Expr::printTree(std::ostream& os, NodeId r) {
+	if (r == NONODE) return;
+	const Node& n = (*arena)[r];
 	
-	if (r->op == NodeType::NUM) {
-		std::cout << r->value << " ";
+	if (n.op == NodeType::NUM) {
+		os << n.value << " ";
 	}
-	else if (r->op == NodeType::VAR) {
-		std::cout << r->name << " ";
+	else if (n.op == NodeType::VAR) {
+		os << arena->nameOf(n.name) << " ";
 	}
-	else if (r->op == NodeType::OP || r->op == NodeType::WAVE) {
-		std::cout << r->oper << " ";
+	else if (n.op == NodeType::OP || n.op == NodeType::WAVE) {
+		os << n.oper << " ";
 	}
-	else if (r->op == NodeType::INTEG) {
-		std::cout << "Integrate: ";
+	else if (n.op == NodeType::INTEG) {
+		os << "Integrate: ";
 	}
 
-	if (r->left != nullptr) printTree(r->left);	
+	if (n.left != NONODE) printTree(os, n.left);	
 
-	if (r->right != nullptr) printTree(r->right);
+	if (n.right != NONODE) printTree(os, n.right);
 }
 
-void Expr::removeTree(Node* r) {
-	if (r == nullptr) {
-		return;
+void SlotArray::assign(const std::vector<var>& v) {
+	value.resize(v.size());
+	rho.resize(v.size());
+	delta.resize(v.size());
+	for (size_t i = 0; i < v.size(); i += 1) {
+		value[i] = v[i].value;
+		rho[i] = v[i].rho;
+		delta[i] = v[i].delta;
 	}
+}
 
-	removeTree(r->left);
-	removeTree(r->right);
-	delete r;
+void SlotArray::assign(const std::vector<global_var>& v) {
+	value.resize(v.size());
+	rho.resize(v.size());
+	delta.resize(v.size());
+	for (size_t i = 0; i < v.size(); i += 1) {
+		value[i] = v[i].value;
+		rho[i] = v[i].rho;
+		delta[i] = v[i].delta;
+	}
 }
 
-double Expr::Evaluate(const std::vector<var> constants,
-											const std::vector<var> vars,
-											const std::vector<global_var> global) {
-  
-  std::vector<var> merged_vars = vars;
-
-  for (const auto& g : global) {
-  	var v;
-  	v.name = g.name;
-  	v.value = g.value;
-  	v.rho = g.rho;
-  	v.delta = g.delta;
-  	merged_vars.push_back(v);
-  }
+double Expr::Evaluate(const EvalContext& ctx) {
+	if (!code.empty()) {
+		return EvaluateCode(ctx);
+	}
+	return EvaluateTree(ctx);
+}
 
+double Expr::EvaluateTree(const EvalContext& ctx) {
+  const Node& r = (*arena)[root];
   double res = 0.0;
 	if (rho != 0.0) {
-		if (root->op == NodeType::INTEG) {
-			res = (EvaluateBUScaled(merged_vars, constants, root->right) - delta) / rho;
+		if (r.op == NodeType::INTEG) {
+			res = (EvaluateBUScaled(ctx, r.right) - delta) / rho;
 		}
 		else {
-			res = (EvaluateBUScaled(merged_vars, constants, root) - delta) / rho;
+			res = (EvaluateBUScaled(ctx, root) - delta) / rho;
 		}
 	}
 	else {
-		if (root->op == NodeType::INTEG) {
-			res = EvaluateBU(merged_vars, constants, root->right);
+		if (r.op == NodeType::INTEG) {
+			res = EvaluateBU(ctx, r.right);
 		}
 		else {
-			res = EvaluateBU(merged_vars, constants, root);
+			res = EvaluateBU(ctx, root);
 		}		
 	}
 	return res;
 }
 
-double Expr::EvaluateBU(const std::vector<var>& vars,
-												const std::vector<var>& constants,
-												Node* r) {
+/*
+*		Pick the value array a bound variable node reads from
+*/
+static const SlotArray* slotArray(const EvalContext& ctx, SlotKind kind) {
+	switch (kind) {
+	case SlotKind::CONSTANT:
+		return &ctx.constants;
+	case SlotKind::LOCAL:
+		return &ctx.locals;
+	case SlotKind::GLOBAL:
+		return ctx.globals;
+	default:
+		throw std::invalid_argument("Variable not found\n");
+	}
+}
+
+double Expr::EvaluateBU(const EvalContext& ctx, NodeId id) {
 
 	double leftVal;
 	double rightVal;
-	if (r == nullptr) {
+	if (id == NONODE) {
 		return 0.0;
 	}
-	else if (r->op == NodeType::NUM) {
-		return r->value;
+	const Node& r = (*arena)[id];
+	if (r.op == NodeType::NUM) {
+		return r.value;
 	}
-	else if (r->op == NodeType::VAR) {
-		std::string x = r->name;
-    auto it = std::find_if(constants.begin(), constants.end(), [&x](const var& c) {
-        return c.name == x;
-    });
-		if (it != constants.end()) {
-			return it->value;
-		}
-
-    it = std::find_if(vars.begin(), vars.end(), [&x](const var& v) {
-        return v.name == x;
-    });
-		if (it != vars.end()) {
-			return it->value;
-		}
-		else {
-			throw std::invalid_argument("Variable not found\n");
-		}
+	else if (r.op == NodeType::VAR) {
+		return slotArray(ctx, r.kind)->value[r.slot];
 	}
-	else if (r->op == NodeType::WAVE && r->oper == 's') {
-		rightVal = EvaluateBU(vars, constants, r->right);
+	else if (r.op == NodeType::WAVE && r.oper == 's') {
+		rightVal = EvaluateBU(ctx, r.right);
 		return std::sin(rightVal);
 	} 
-	else if (r->op == NodeType::WAVE && r->oper == 'c') {
-		rightVal = EvaluateBU(vars, constants, r->right);
+	else if (r.op == NodeType::WAVE && r.oper == 'c') {
+		rightVal = EvaluateBU(ctx, r.right);
 		return std::cos(rightVal);
 	}
 
-	leftVal = EvaluateBU(vars, constants, r->left);
-	rightVal = EvaluateBU(vars, constants, r->right);
+	leftVal = EvaluateBU(ctx, r.left);
+	rightVal = EvaluateBU(ctx, r.right);
 
-	switch(r->oper) {
+	switch(r.oper) {
 	case '+':
 		return leftVal + rightVal;
 	case '-':
@@ -142,50 +150,34 @@ double Expr::EvaluateBU(const std::vector<var>& vars,
 	}
 }
 
-double Expr::EvaluateBUScaled(const std::vector<var>& vars,
-															const std::vector<var>& constants,
-															Node* r) {
+double Expr::EvaluateBUScaled(const EvalContext& ctx, NodeId id) {
 	double leftVal;
 	double rightVal;
 
-	if (r == nullptr) {
+	if (id == NONODE) {
 		return 0.0;
 	}
-	else if (r->op == NodeType::NUM) {
-		return ((r->value / rho) + delta);
+	const Node& r = (*arena)[id];
+	if (r.op == NodeType::NUM) {
+		return ((r.value / rho) + delta);
 	}
-	else if (r->op == NodeType::VAR) {
-		std::string x = r->name;
-		auto it = std::find_if(constants.begin(), constants.end(), [&x](const var& c) {
-			return c.name == x;
-		});
-		if (it != constants.end()) {
-			return ((it->value / it->rho) + it->delta);
-		}
-
-		it = std::find_if(vars.begin(), vars.end(), [&x](const var& v) {
-			return v.name == x;
-		});
-		if (it != vars.end()) {
-			return ((it->value / it->rho) + it->delta);
-		}
-		else {
-			throw std::invalid_argument("Variable not found\n");
-		}
+	else if (r.op == NodeType::VAR) {
+		const SlotArray* a = slotArray(ctx, r.kind);
+		return ((a->value[r.slot] / a->rho[r.slot]) + a->delta[r.slot]);
 	} 
-	else if (r->op == NodeType::WAVE && r->oper == 's') {
-		rightVal = EvaluateBUScaled(vars, constants, r->right);
+	else if (r.op == NodeType::WAVE && r.oper == 's') {
+		rightVal = EvaluateBUScaled(ctx, r.right);
 		return std::sin(rightVal);
 	} 
-	else if (r->op == NodeType::WAVE && r->oper == 'c') {
-		rightVal = EvaluateBUScaled(vars, constants, r->right);
+	else if (r.op == NodeType::WAVE && r.oper == 'c') {
+		rightVal = EvaluateBUScaled(ctx, r.right);
 		return std::cos(rightVal);
 	}
 
-	leftVal = EvaluateBUScaled(vars, constants, r->left);
-	rightVal = EvaluateBUScaled(vars, constants, r->right);
+	leftVal = EvaluateBUScaled(ctx, r.left);
+	rightVal = EvaluateBUScaled(ctx, r.right);
 
-	switch(r->oper) {
+	switch(r.oper) {
 	case '+':
 		return leftVal + rightVal;
 	case '-':
@@ -202,53 +194,186 @@ double Expr::EvaluateBUScaled(const std::vector<var>& vars,
 	}
 }
 
-void Expr::returnLeaves(Node* r, std::vector<Node*> &inp) {
-	if (r == nullptr) return;
-	if (r->op == NodeType::VAR || r->op == NodeType::NUM) {
+/*
+*		Bind every variable node to the slot its value is read from, symbols is
+*		indexed by the interned name. Unbound variables are reported when they
+*		are evaluated
+*/
+void Expr::resolve(const std::vector<Slot>& symbols) {
+	std::vector<NodeId> stack;
+	if (root != NONODE) stack.push_back(root);
+	while (!stack.empty()) {
+		Node& n = (*arena)[stack.back()];
+		stack.pop_back();
+		if (n.op == NodeType::VAR) {
+			n.kind = symbols[n.name].kind;
+			n.slot = symbols[n.name].index;
+			continue;
+		}
+		if (n.left != NONODE) stack.push_back(n.left);
+		if (n.right != NONODE) stack.push_back(n.right);
+	}
+}
+
+void Expr::returnLeaves(NodeId r, std::vector<NodeId> &inp, std::unordered_set<NodeId> &seen) {
+	if (r == NONODE || !seen.insert(r).second) return;
+	const Node& n = (*arena)[r];
+	if (n.op == NodeType::VAR || n.op == NodeType::NUM) {
 		inp.push_back(r);
 		return;
 	}
-	returnLeaves(r->left, inp);
-	returnLeaves(r->right, inp);
+	returnLeaves(n.left, inp, seen);
+	returnLeaves(n.right, inp, seen);
+}
+
+size_t Expr::countCABs(NodeId id) {
+	if (id == NONODE) return 0;
+	const Node& n = (*arena)[id];
+	if (n.op == NodeType::NUM || n.op == NodeType::VAR) return 0;
+	return 1 + countCABs(n.left) + countCABs(n.right);
+}
+
+/*
+*		Return the node of the same shape seen first, so a subterm which occurs
+*		more than once becomes a single node
+*/
+NodeId Expr::share(NodeId id, NodeTable& shared) {
+	if (id == NONODE) return NONODE;
+	auto it = shared.emplace((*arena)[id], id);
+	return it.first->second;
+}
+
+/*
+*		Build a simplified copy of the tree for the FPAA configuration. Subtrees of
+*		literals and constants are computed so they take one input instead of
+*		CABs, and operations with a neutral operand are dropped. Equal subterms
+*		are shared so they take a single CAB. Nodes which are kept keep their
+*		number so the remaining CABs are named as before
+*/
+NodeId Expr::foldTree(NodeId id, const std::vector<var>& constants, NodeTable& shared,
+											bool& isConst, double& value) {
+	isConst = false;
+	if (id == NONODE) return NONODE;
+	Node n = (*arena)[id];
+
+	if (n.op == NodeType::NUM) {
+		isConst = true;
+		value = n.value;
+		return share(id, shared);
+	}
+	if (n.op == NodeType::VAR) {
+		auto j = std::find_if(constants.begin(), constants.end(), [this, &n](const var& a) {
+			return a.name == arena->nameOf(n.name);
+		});
+		if (j != constants.end()) {
+			isConst = true;
+			value = j->value;
+		}
+		return share(id, shared);
+	}
+
+	bool leftConst, rightConst;
+	double leftVal = 0.0, rightVal = 0.0;
+	NodeId left = foldTree(n.left, constants, shared, leftConst, leftVal);
+	NodeId right = foldTree(n.right, constants, shared, rightConst, rightVal);
+
+	if (n.op == NodeType::WAVE && (n.oper == 's' || n.oper == 'c') && rightConst) {
+		isConst = true;
+		value = (n.oper == 's') ? std::sin(rightVal) : std::cos(rightVal);
+		return share(arena->add(Node(value, n.num)), shared);
+	}
+	if (n.op == NodeType::OP) {
+		if (leftConst && rightConst && (n.oper == '+' || n.oper == '-' || n.oper == '*' ||
+				(n.oper == '/' && rightVal != 0.0))) {
+			isConst = true;
+			switch (n.oper) {
+			case '+':
+				value = leftVal + rightVal;
+				break;
+			case '-':
+				value = leftVal - rightVal;
+				break;
+			case '*':
+				value = leftVal * rightVal;
+				break;
+			default:
+				value = leftVal / rightVal;
+				break;
+			}
+			return share(arena->add(Node(value, n.num)), shared);
+		}
+		if (rightConst && ((rightVal == 1.0 && (n.oper == '*' || n.oper == '/')) ||
+				(rightVal == 0.0 && (n.oper == '+' || n.oper == '-')))) {
+			isConst = leftConst;
+			value = leftVal;
+			return left;
+		}
+		if (leftConst && ((leftVal == 1.0 && n.oper == '*') || (leftVal == 0.0 && n.oper == '+'))) {
+			isConst = rightConst;
+			value = rightVal;
+			return right;
+		}
+	}
+
+	if (left == n.left && right == n.right) {
+		return share(id, shared);
+	}
+	n.left = left;
+	n.right = right;
+	return share(arena->add(n), shared);
 }
 
 void Expr::FPAAPrintConfig(std::ofstream &of, const int c,
 											const std::vector<var> constants,
 											const std::vector<var> vars,
 											const std::vector<global_var> global,
-											const std::string exprName) {
-	auto inputMap = FPAASetInputs(of, c, constants);
+											const std::string exprName,
+											CABCount& count) {
+	bool isConst;
+	double value;
+	NodeTable shared;
+	NodeId r = foldTree(root, constants, shared, isConst, value);
+	auto inputMap = FPAASetInputs(of, c, r, constants);
 	
-	FPAASetCABs(of, root, inputMap);
+	std::unordered_set<NodeId> emitted;
+	FPAASetCABs(of, r, inputMap, emitted);
+	count.tree += countCABs(root);
+	count.emitted += emitted.size();
 	FPAASetOutputs(of, c, global, exprName);
 	return;
 }
 
 std::unordered_map<std::string, std::string> Expr::FPAASetInputs(std::ofstream &of, 
 																																const int c, 
+																																NodeId r,
 																																const std::vector<var> constants) {
-	std::vector<Node*> inputs;
+	std::vector<NodeId> inputs;
 	std::unordered_map<std::string, std::string> inputMap;
 
-	returnLeaves(root, inputs);
+	std::unordered_set<NodeId> seen;
+	returnLeaves(r, inputs, seen);
 
 	for (size_t i = 0; i < inputs.size(); i += 1) {
 		std::string inputValue;
 		std::string mapValue;
+		const Node& n = (*arena)[inputs[i]];
 
-		auto j = std::find_if(constants.begin(), constants.end(), [&inputs, i](const var& a) {
-			return a.name == inputs[i]->name;
-		});
+		auto j = constants.end();
+		if (n.op == NodeType::VAR) {
+			j = std::find_if(constants.begin(), constants.end(), [this, &n](const var& a) {
+				return a.name == arena->nameOf(n.name);
+			});
+		}
 		if (j != constants.end()) {
 			inputValue = std::to_string(j->value);
 			mapValue = j->name;
 		}
-		else if (inputs[i]->op == NodeType::NUM) {
-			inputValue = std::to_string(inputs[i]->value);
+		else if (n.op == NodeType::NUM) {
+			inputValue = std::to_string(n.value);
 			mapValue = inputValue;
 		}
 		else {
-			inputValue = inputs[i]->name;
+			inputValue = arena->nameOf(n.name);
 			mapValue = inputValue;
 		}
 		std::string tmp = "\tFPAA" + std::to_string(c) + "_inp" + std::to_string(i);
@@ -258,9 +383,10 @@ std::unordered_map<std::string, std::string> Expr::FPAASetInputs(std::ofstream &
 	return inputMap;
 }
 
-void Expr::FPAAPrintInputVariables(std::ofstream &of, Node* r, const std::unordered_map<std::string, std::string> inputMap) {
-		if (r->op == NodeType::VAR) {
-		auto tmp = inputMap.find(r->name);
+void Expr::FPAAPrintInputVariables(std::ofstream &of, NodeId id, const std::unordered_map<std::string, std::string> inputMap) {
+	const Node& r = (*arena)[id];
+	if (r.op == NodeType::VAR) {
+		auto tmp = inputMap.find(arena->nameOf(r.name));
 		if (tmp != inputMap.end()) {
 			of << tmp->second << ";\n";
 		}
@@ -268,8 +394,8 @@ void Expr::FPAAPrintInputVariables(std::ofstream &of, Node* r, const std::unorde
 			throw std::invalid_argument("Variable not found\n");
 		}
 	}
-	else if (r->op == NodeType::NUM) {
-		auto tmp = inputMap.find(std::to_string(r->value));
+	else if (r.op == NodeType::NUM) {
+		auto tmp = inputMap.find(std::to_string(r.value));
 		if (tmp != inputMap.end()) {
 			of << tmp->second << ";\n";
 		}
@@ -278,24 +404,28 @@ void Expr::FPAAPrintInputVariables(std::ofstream &of, Node* r, const std::unorde
 		}
 	}
 	else {
-		of << "CAB" << r->num << ";\n";
+		of << "CAB" << r.num << ";\n";
 	}
 }
 
-void Expr::FPAASetCABs(std::ofstream &of, Node* r, const std::unordered_map<std::string, std::string> inputMap) {
-	if (r == nullptr || r->op == NodeType::NUM || r->op == NodeType::VAR) return;
+void Expr::FPAASetCABs(std::ofstream &of, NodeId id, const std::unordered_map<std::string, std::string> inputMap,
+											 std::unordered_set<NodeId> &emitted) {
+	if (id == NONODE) return;
+	const Node& r = (*arena)[id];
+	if (r.op == NodeType::NUM || r.op == NodeType::VAR) return;
+	if (!emitted.insert(id).second) return;
 
-	FPAASetCABs(of, r->left, inputMap);
-	FPAASetCABs(of, r->right, inputMap);
+	FPAASetCABs(of, r.left, inputMap, emitted);
+	FPAASetCABs(of, r.right, inputMap, emitted);
 
-	of << "\tCAB" << r->num << " {\n";
-	switch(r->op) {
+	of << "\tCAB" << r.num << " {\n";
+	switch(r.op) {
 	case NodeType::INTEG:
 		of << "\t\top = integ;\n\t\tinp0 = ";
-		FPAAPrintInputVariables(of, r->right, inputMap);
+		FPAAPrintInputVariables(of, r.right, inputMap);
 		break;
 	case NodeType::WAVE:
-		switch(r->oper) {
+		switch(r.oper) {
 		case 's':
 			of << "\t\top = sin;\n";
       break;
@@ -303,13 +433,13 @@ void Expr::FPAASetCABs(std::ofstream &of, Node* r, const std::unordered_map<std:
 			of << "\t\top = cos;\n";
       break;
 		default:
-			throw std::invalid_argument(std::string("Invalid wave function: ") + r->oper + "\n");
+			throw std::invalid_argument(std::string("Invalid wave function: ") + r.oper + "\n");
 		}
 		of << "\t\tinp0 = ";
-		FPAAPrintInputVariables(of, r->right, inputMap);
+		FPAAPrintInputVariables(of, r.right, inputMap);
 		break;
 	case NodeType::OP:
-		switch(r->oper) {
+		switch(r.oper) {
 		case '+':
 			of << "\t\top = sum;\n";
 			break;
@@ -326,9 +456,9 @@ void Expr::FPAASetCABs(std::ofstream &of, Node* r, const std::unordered_map<std:
 			throw std::invalid_argument("Invalid operation\n");
 		}
 		of << "\t\tinp0 = ";
-		FPAAPrintInputVariables(of, r->left, inputMap);
+		FPAAPrintInputVariables(of, r.left, inputMap);
 		of << "\t\tinp1 = ";
-		FPAAPrintInputVariables(of, r->right, inputMap);
+		FPAAPrintInputVariables(of, r.right, inputMap);
 		break;
 	default:
 		throw std::invalid_argument("Invalid node type\n");
@@ -359,131 +489,246 @@ void Expr::FPAASetOutputs(std::ofstream &of,
 }
 
 bool Expr::isInteg() {
-	if (root->op == NodeType::INTEG) return true;
+	if ((*arena)[root].op == NodeType::INTEG) return true;
 	return false;
 }
 
-void Expr::parse(std::string e) {	
-	if (e.substr(0, 5) == "integ") {
-		std::regex reg(R"(\s*integ\(([^,]+)\s*,\s*([+-]?[0-9]*[.]?[0-9]+))");
-		std::smatch s;
-		if (regex_search(e, s, reg) && s.size() == 3) {
-			tokens = tokenise(s.str(1));
-			initCondit = std::stod(s.str(2));
-
-			root = new Node(NodeType::INTEG, 0);
-			root->right = buildTree(tokens);
+/*
+*		Report a syntax error at pos, the position is relative to the expression
+*		text and is rebased onto the input file by the caller
+*/
+[[noreturn]] static void fail(std::string_view e, size_t pos, const std::string& msg) {
+	int line = 1;
+	int col = 1;
+	for (size_t i = 0; i < pos && i < e.size(); i += 1) {
+		if (e[i] == '\n') {
+			line += 1;
+			col = 1;
+		}
+		else {
+			col += 1;
 		}
 	}
-	else {
-		initCondit = std::stod(e);
-		tokens = tokenise(e);
-		root = buildTree(tokens);
+	if (pos >= e.size()) {
+		throw ParseError(msg + " but found end of expression", line, col);
+	}
+	throw ParseError(msg + " but found '" + e[pos] + "'", line, col);
+}
+
+static void skipSpace(std::string_view e, size_t& pos) {
+	while (pos < e.size() && std::isspace((unsigned char)e[pos])) {
+		pos += 1;
+	}
+}
+
+static bool isIdentStart(char ch) {
+	return std::isalpha((unsigned char)ch) || ch == '_';
+}
+
+static bool isIdentChar(char ch) {
+	return std::isalnum((unsigned char)ch) || ch == '_';
+}
+
+static bool isNumberStart(std::string_view e, size_t pos) {
+	return std::isdigit((unsigned char)e[pos]) ||
+		(e[pos] == '.' && pos + 1 < e.size() && std::isdigit((unsigned char)e[pos + 1]));
+}
+
+/*
+*		Scan an unsigned number with optional fraction and exponent
+*/
+static double scanNumber(std::string_view e, size_t& pos) {
+	double v;
+	auto res = std::from_chars(e.data() + pos, e.data() + e.size(), v);
+	if (res.ec != std::errc()) {
+		fail(e, pos, "expected a number");
 	}
+	pos = res.ptr - e.data();
+	return v;
 }
 
 /*
-*		Convert an infix tokenised vector to a tokenised vector of an expression
-*		in Polish notation using the shunting yard algorithm
+*		Scan an identifier and advance past it
 */
-std::vector<std::string> Expr::prefixToPolish(std::vector<std::string> v) {
-	std::vector<std::string> polish;
-	std::stack<std::string> s;
-	for (auto t: v) {
-		if (t == "+" || t == "-") {
-			while (!s.empty() && (s.top() == "+" || s.top() == "-" || s.top() == "*" || s.top() == "/")) {
-				polish.push_back(s.top());
-				s.pop();
-			}
-			s.push(t);
-		} 
-		else if (t == "*" || t == "/") {
-			while (!s.empty() && (s.top() == "*" || s.top() == "/")) {
-				polish.push_back(s.top());
-				s.pop();
-			}
-			s.push(t);
+static std::string_view scanIdent(std::string_view e, size_t& pos) {
+	size_t start = pos;
+	while (pos < e.size() && isIdentChar(e[pos])) {
+		pos += 1;
+	}
+	return e.substr(start, pos - start);
+}
+
+static void expectChar(std::string_view e, size_t& pos, char ch) {
+	skipSpace(e, pos);
+	if (pos >= e.size() || e[pos] != ch) {
+		fail(e, pos, std::string("expected '") + ch + "'");
+	}
+	pos += 1;
+}
+
+static int precedence(char op) {
+	switch (op) {
+	case '+':
+	case '-':
+		return 1;
+	case '*':
+	case '/':
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+/*
+*		Parse a variable definition, either integ(<expr>, <init>) or a constant.
+*		The expression is parsed straight into nodes by precedence climbing, the
+*		nodes are numbered in the order they are completed which gives every
+*		operator a higher number than its operands. Nodes left behind by a syntax
+*		error stay unused in the arena
+*/
+void Expr::parse(std::string_view e) {	
+	size_t pos = 0;
+	int c = 1;
+
+	skipSpace(e, pos);
+	size_t start = pos;
+	if (pos < e.size() && isIdentStart(e[pos]) && scanIdent(e, pos) == "integ") {
+		expectChar(e, pos, '(');
+		NodeId body = parseBinary(e, pos, 1, c);
+		expectChar(e, pos, ',');
+		skipSpace(e, pos);
+		bool negative = pos < e.size() && e[pos] == '-';
+		if (pos < e.size() && (e[pos] == '-' || e[pos] == '+')) {
+			pos += 1;
 		}
-		else if (t == "sin" || t == "cos" || t == "(") {
-			s.push(t);
+		if (pos >= e.size() || !isNumberStart(e, pos)) {
+			fail(e, pos, "expected an initial condition");
 		}
-		else if (t == ")") {
-			while (!s.empty() && s.top() != "(") {
-				polish.push_back(s.top());
-				s.pop();
-			}
-			if (!s.empty() && s.top() == "(") {
-				s.pop();
-			}
+		initCondit = scanNumber(e, pos);
+		if (negative) {
+			initCondit = -initCondit;
+		}
+		expectChar(e, pos, ')');
 
-			if (!s.empty() && (s.top() == "sin" || s.top() == "cos")) {
-				polish.push_back(s.top());
-				s.pop();
-			}
+		Node n(NodeType::INTEG, 0);
+		n.right = body;
+		root = arena->add(n);
+	}
+	else {
+		pos = start;
+		NodeId r = parseBinary(e, pos, 1, c);
+		if ((*arena)[r].op != NodeType::NUM) {
+			fail(e, start, "constant variable must be a number");
 		}
-		else polish.push_back(t);
-	}	
-	while(!s.empty()) {
-		polish.push_back(s.top());
-		s.pop();
+		root = r;
+		initCondit = (*arena)[r].value;
 	}
 
-	return polish;
+	skipSpace(e, pos);
+	if (pos < e.size()) {
+		root = NONODE;
+		fail(e, pos, "expected end of expression");
+	}
 }
 
 /*
-*		Tokenise an expression into a vector of strings
+*		Parse operands joined by operators of at least minPrec, all binary
+*		operators are left associative
 */
-std::vector<std::string> Expr::tokenise(const std::string e) {
-	std::vector<std::string> v;
-	std::regex reg(R"(sin|cos|[+-]?[0-9]*[.]?[0-9]+|[+-]?[\w]+|[*\/+\-()])");
-	auto t_begin = std::sregex_iterator(e.begin(), e.end(), reg);
-	auto t_end = std::sregex_iterator();
-
-	for (std::sregex_iterator i = t_begin; i != t_end; i++) {
-		std::string token = (*i).str();
-		if (token[0] == '-' && (std::isalpha(token[1]) || std::isdigit(token[1]))) {
-			v.push_back("-1");
-			v.push_back("*");
-			token = token.substr(1);
-		}
-		v.push_back(token);
-	} 
+NodeId Expr::parseBinary(std::string_view e, size_t& pos, int minPrec, int& c) {
+	NodeId left = parseUnary(e, pos, c);
 
-	v = prefixToPolish(v);
-	return v;
+	while (true) {
+		skipSpace(e, pos);
+		if (pos >= e.size()) {
+			break;
+		}
+		char op = e[pos];
+		int prec = precedence(op);
+		if (prec == 0 || prec < minPrec) {
+			break;
+		}
+		pos += 1;
+
+		NodeId right = parseBinary(e, pos, prec + 1, c);
+		Node n(op, c++);
+		n.left = left;
+		n.right = right;
+		left = arena->add(n);
+	}
+	return left;
 }
 
 /*
-*		Build a tree from a reverse polish notation tokenised expression
+*		A leading minus on a number is part of the literal, on anything else it
+*		becomes a multiplication by -1
 */
-Node* Expr::buildTree(std::vector<std::string>& tokens) {
-	std::stack<Node*> nodeStack;
-	int c = 1;
-	for (auto& t: tokens) {
-		if (std::isdigit(t[0]) || (t[0] == '-' && (int)t.length() > 1)) {
-			nodeStack.push(new Node(std::stod(t), c));
-		}
-		else if (t == "sin" || t == "cos") {
-			Node* n = new Node(NodeType::WAVE, t[0], c);
-			n->right = nodeStack.top();
-			nodeStack.pop();
-			nodeStack.push(n);
-		}		
-		else if (std::isalpha(t[0]) || t[0] == '_') {
-			nodeStack.push(new Node(t, c));
+NodeId Expr::parseUnary(std::string_view e, size_t& pos, int& c) {
+	skipSpace(e, pos);
+	if (pos < e.size() && e[pos] == '+') {
+		pos += 1;
+		return parseUnary(e, pos, c);
+	}
+	if (pos < e.size() && e[pos] == '-') {
+		pos += 1;
+		skipSpace(e, pos);
+		if (pos < e.size() && isNumberStart(e, pos)) {
+			return arena->add(Node(-scanNumber(e, pos), c++));
 		}
-		else {
-			Node* n = new Node(t[0], c);
-			n->right = nodeStack.top();
-			nodeStack.pop();
-			n->left = nodeStack.top();
-			nodeStack.pop();
-			nodeStack.push(n);
+		NodeId minusOne = arena->add(Node(-1.0, c++));
+		NodeId operand = parseUnary(e, pos, c);
+		Node n('*', c++);
+		n.left = minusOne;
+		n.right = operand;
+		return arena->add(n);
+	}
+	return parsePrimary(e, pos, c);
+}
+
+/*
+*		<number> | <var> | sin(<expr>) | cos(<expr>) | (<expr>)
+*/
+NodeId Expr::parsePrimary(std::string_view e, size_t& pos, int& c) {
+	skipSpace(e, pos);
+	if (pos >= e.size()) {
+		fail(e, pos, "expected an operand");
+	}
+
+	if (isNumberStart(e, pos)) {
+		return arena->add(Node(scanNumber(e, pos), c++));
+	}
+	if (e[pos] == '(') {
+		pos += 1;
+		NodeId n = parseBinary(e, pos, 1, c);
+		expectChar(e, pos, ')');
+		return n;
+	}
+	if (isIdentStart(e[pos])) {
+		std::string_view name = scanIdent(e, pos);
+		size_t after = pos;
+		skipSpace(e, after);
+		if ((name == "sin" || name == "cos") && after < e.size() && e[after] == '(') {
+			pos = after + 1;
+			NodeId arg = parseBinary(e, pos, 1, c);
+			expectChar(e, pos, ')');
+			Node n(NodeType::WAVE, name[0], c++);
+			n.right = arg;
+			return arena->add(n);
 		}
-		c += 1;
+		return arena->addVar(name, c++);
 	}
-	return nodeStack.top();
+	fail(e, pos, "expected an operand");
+}
+
+/*
+*		Scale an initial value the way setScalar scaled the one of the input,
+*		constants have a delta of 0
+*/
+double Expr::scaleInit(double v) {
+	if (rho == 0.0) {
+		return v;
+	}
+	return rho * (v - delta);
 }
 
 /*
@@ -502,12 +747,41 @@ void Expr::setScalar(std::pair<double,double> i) {
 		delta = 0.0;
 		initCondit *= rho;
 
-		if (root->op == NodeType::NUM) {
-			root->value *= rho;
+		if ((*arena)[root].op == NodeType::NUM) {
+			(*arena)[root].value *= rho;
 		}
 	}
+}
+
+/*
+*		Write the scalars and the root to the compiled-system cache, the nodes
+*		themselves are written with the arena
+*/
+void Expr::serialize(CacheWriter& w) const {
+	w.put(initCondit);
+	w.put(rho);
+	w.put(delta);
+	w.put(root);
+}
+
+void Expr::deserialize(CacheReader& r) {
+	initCondit = r.get<double>();
+	rho = r.get<double>();
+	delta = r.get<double>();
+	root = r.get<NodeId>();
+	if (root >= arena->size()) {
+		throw std::out_of_range("Invalid node in cache file\n");
+	}
+}
 
-	std::cout << rho << ' ' << delta << '\n';
+/*
+*		Point the expression at the arena its nodes were moved to
+*/
+void Expr::relocate(NodeArena* a, NodeId offset) {
+	arena = a;
+	if (root != NONODE) {
+		root += offset;
+	}
 }
 
 double Expr::getRho() {
@@ -518,10 +792,14 @@ double Expr::getDelta() {
 	return delta;
 }
 
+NodeArena* Expr::getArena() {
+	return arena;
+}
+
 double Expr::getInit() {
 	return initCondit;
 }
 
-Node* Expr::getRoot() {
+NodeId Expr::getRoot() {
 	return root;
 }
@@ -0,0 +1,42 @@
+/******************************************************************************\
+*Header file for the expression bytecode
+*An expression is lowered to a linear program for a small stack machine once
+*its variables are bound to slots. Scaling is decided when compiling, so the
+*scaled and unscaled evaluations each get their own load instructions
+\******************************************************************************/
+#ifndef BYTECODEH
+#define BYTECODEH
+
+#include <cstdint>
+
+enum class OpCode : uint8_t {
+	PUSH,					//push a
+	LOADC,				//push the constant in slot
+	LOADL,				//push the local var in slot
+	LOADG,				//push the global in slot
+	LOADC_S,			//push the constant in slot scaled by a, b
+	LOADL_S,			//push the local var in slot scaled by a, b
+	LOADG_S,			//push the global in slot scaled by a, b
+	ADD,
+	SUB,
+	MUL,
+	DIV,
+	SIN,
+	COS,
+	FAIL,					//raise the error given by slot
+};
+
+//Errors raised by FAIL, kept lazy so they surface at evaluation as before
+enum FailReason : uint32_t {
+	VARNOTFOUND,
+	OPNOTFOUND,
+};
+
+struct Instr {
+	OpCode op;
+	uint32_t slot;
+	double a;
+	double b;
+};
+
+#endif
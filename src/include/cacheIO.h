@@ -0,0 +1,76 @@
+/******************************************************************************\
+*Header file for reading and writing the binary compiled-system cache
+*Values are stored in native byte order, the cache is only meant to be read
+*back on the machine which wrote it
+\******************************************************************************/
+#ifndef CACHEIOH
+#define CACHEIOH
+
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+class CacheWriter {
+public:
+	CacheWriter(std::ofstream& o) : of(o) {}
+
+	template<typename T>
+	void put(const T& v) {
+		of.write(reinterpret_cast<const char*>(&v), sizeof(T));
+	}
+
+	void putString(std::string_view s) {
+		put<uint32_t>(s.size());
+		of.write(s.data(), s.size());
+	}
+
+	void putBytes(const void* p, size_t n) {
+		of.write(reinterpret_cast<const char*>(p), n);
+	}
+
+private:
+	std::ofstream& of;
+};
+
+class CacheReader {
+public:
+	CacheReader(std::string_view d) : data(d), pos(0) {}
+
+	template<typename T>
+	T get() {
+		T v;
+		std::memcpy(&v, take(sizeof(T)), sizeof(T));
+		return v;
+	}
+
+	std::string getString() {
+		uint32_t n = get<uint32_t>();
+		return std::string(take(n), n);
+	}
+
+	void getBytes(void* p, size_t n) {
+		std::memcpy(p, take(n), n);
+	}
+
+	bool atEnd() const {
+		return pos == data.size();
+	}
+
+private:
+	const char* take(size_t n) {
+		if (data.size() - pos < n) {
+			throw std::out_of_range("Truncated cache file\n");
+		}
+		const char* p = data.data() + pos;
+		pos += n;
+		return p;
+	}
+
+	std::string_view data;
+	size_t pos;
+};
+
+#endif
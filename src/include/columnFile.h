@@ -0,0 +1,224 @@
+/******************************************************************************\
+*Header file for the binary columnar simulation output
+*A fixed header, the names of the columns, then the time of every row as one
+*block of doubles followed by one block per emitted global, of doubles or
+*floats. The number of rows is known before the simulation, so each block has
+*its place in the file from the start and a column is read without parsing:
+*
+*  magic     8 bytes "ODECOL2\0"
+*  order     uint64 0x0102030405060708, shows the byte order of the file
+*  itemSize  uint32, 8 or 4 bytes per value of the globals
+*  columns   uint32, the globals, time not counted
+*  rows      uint64
+*  data      uint64, offset of the time block, a multiple of COLUMNALIGN
+*  names     per column an uint32 length and the bytes of the name
+*
+*The level of detail sidecar holds a pyramid of the recorded rows: level 0
+*has the minimum, maximum and mean of every global over each block of
+*LODBLOCK rows, every level above over blocks twice as long, up to one block
+*for all rows. After the same fixed header and names every level holds the
+*time of the first row of its blocks, then per global the minimum, maximum
+*and mean of each block one after the other:
+*
+*  magic     8 bytes "ODELOD2\0"
+*  order     uint64 0x0102030405060708
+*  block     uint32, rows of a block of level 0
+*  columns   uint32
+*  rows      uint64
+*  levels    uint64
+*  data      uint64, offset of level 0, a multiple of COLUMNALIGN
+*
+*All numbers are in the byte order of the machine which wrote the file. The
+*readers map the values as they are and only open files of their own byte
+*order, res/columns.py reads either
+\******************************************************************************/
+#ifndef COLUMNFILEH
+#define COLUMNFILEH
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "mappedFile.h"
+
+struct ColumnHeader {
+	char magic[8];
+	uint64_t order;
+	uint32_t itemSize;
+	uint32_t columns;
+	uint64_t rows;
+	uint64_t data;
+};
+
+struct LodHeader {
+	char magic[8];
+	uint64_t order;
+	uint32_t block;
+	uint32_t columns;
+	uint64_t rows;
+	uint64_t levels;
+	uint64_t data;
+};
+
+//what a query of the pyramid returns for one pixel
+struct Envelope {
+	double time;
+	double min;
+	double max;
+	double mean;
+};
+
+class ColumnWriter {
+public:
+	ColumnWriter() : fd(-1), itemSize(0), rows(0), columns(0), data(0), written(0), buffered(0), blockRows(0), bytes(0), failed(false) {}
+	~ColumnWriter() {
+		close();
+	}
+
+	ColumnWriter(const ColumnWriter&) = delete;
+	ColumnWriter& operator=(const ColumnWriter&) = delete;
+
+	bool open(const std::string& path, const std::vector<std::string>& names, size_t rows, size_t itemSize);
+	//the time and one value per column
+	void row(double time, const double* values);
+	bool close();
+
+	size_t getBytes() const {
+		return bytes;
+	}
+
+private:
+	bool flush();
+
+	int fd;
+	size_t itemSize;
+	size_t rows;
+	size_t columns;
+	uint64_t data;
+	//rows in the file and rows in the blocks
+	size_t written;
+	size_t buffered;
+	size_t blockRows;
+	size_t bytes;
+	//the rows not written yet, column by column
+	std::vector<double> times;
+	std::vector<double> block;
+	std::vector<float> narrow;
+	bool failed;
+};
+
+class ColumnReader {
+public:
+	ColumnReader() : header{}, base(nullptr) {}
+
+	bool open(const std::string& path);
+
+	size_t getRows() const {
+		return header.rows;
+	}
+	size_t getColumns() const {
+		return header.columns;
+	}
+	size_t getItemSize() const {
+		return header.itemSize;
+	}
+	const std::vector<std::string>& getNames() const {
+		return names;
+	}
+	//the column of the name, getColumns() when there is none
+	size_t find(const std::string& name) const;
+
+	const double* time() const;
+	//the values of a column in the file, nullptr when it has the other width
+	const double* f64(size_t column) const;
+	const float* f32(size_t column) const;
+	//count values of a column from row first, converted to double
+	std::vector<double> read(size_t column, size_t first, size_t count) const;
+
+private:
+	MappedFile file;
+	ColumnHeader header;
+	std::vector<std::string> names;
+	const char* base;
+};
+
+class LodWriter {
+public:
+	LodWriter() : fd(-1), columns(0), rows(0), failed(false) {}
+	~LodWriter() {
+		close();
+	}
+
+	LodWriter(const LodWriter&) = delete;
+	LodWriter& operator=(const LodWriter&) = delete;
+
+	bool open(const std::string& path, const std::vector<std::string>& names, size_t rows);
+	//the time and one value per column, the blocks are written once complete
+	void row(double time, const double* values);
+	bool close();
+
+private:
+	struct Level {
+		size_t span;
+		size_t entries;
+		uint64_t offset;
+		//rows of the block being summed and its first time
+		size_t count;
+		double time;
+		//minimum, maximum and sum of every column of that block
+		std::vector<double> acc;
+		//complete blocks not written yet, per column their minimum, maximum and mean
+		size_t written;
+		size_t buffered;
+		size_t capacity;
+		std::vector<double> times;
+		std::vector<double> block;
+	};
+
+	void add(size_t k, double time, const double* acc, size_t count);
+	void complete(size_t k);
+	void flush(size_t k);
+
+	int fd;
+	size_t columns;
+	size_t rows;
+	std::vector<Level> levels;
+	std::vector<double> single;
+	bool failed;
+};
+
+class LodReader {
+public:
+	LodReader() : header{} {}
+
+	bool open(const std::string& path);
+
+	size_t getRows() const {
+		return header.rows;
+	}
+	size_t getColumns() const {
+		return header.columns;
+	}
+	size_t getLevels() const {
+		return header.levels;
+	}
+	const std::vector<std::string>& getNames() const {
+		return names;
+	}
+	size_t find(const std::string& name) const;
+
+	//the envelope of a column from time t0 to t1 in at most pixels parts, from
+	//the coarsest level with at least a block per pixel
+	std::vector<Envelope> query(size_t column, double t0, double t1, size_t pixels) const;
+
+private:
+	MappedFile file;
+	LodHeader header;
+	std::vector<std::string> names;
+	std::vector<size_t> entries;
+	std::vector<const double*> times;
+	std::vector<const double*> blocks;
+};
+
+#endif
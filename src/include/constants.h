@@ -1,7 +1,38 @@
 #ifndef CONSTH
 #define CONSTH
 
+#include <cstddef>
+
 constexpr double FPAALIM = 3.3;
 constexpr double STEPPER = 0.001;
+constexpr size_t BENCHOPS = 50000000;
+//Default tolerances of the steppers with step size control
+constexpr double ABSTOL = 1e-6;
+constexpr double RELTOL = 1e-6;
+//Largest step times spectral radius for which rk4 is stable on the negative real axis
+constexpr double RK4STABLE = 2.78;
+//Steps systems which do not share globals may run ahead of each other
+constexpr size_t STEPRING = 256;
+//Instructions of the right hand side of a large system evaluated by one task,
+//a system with fewer than twice as many runs on one thread
+constexpr size_t RHSCHUNK = 4096;
+//Largest linear system stepped with its dense matrix exponential
+constexpr size_t EXPMSTATES = 512;
+//Bytes of each of the two buffers of the CSV writer
+constexpr size_t WRITEBUF = 1 << 20;
+//Alignment of the data and bytes of the rows buffered by the columnar output
+constexpr size_t COLUMNALIGN = 64;
+constexpr size_t COLUMNBUF = 1 << 24;
+//Rows of a block of the lowest level of the level of detail pyramid
+constexpr size_t LODBLOCK = 16;
+//Frames of the live stream waiting for the viewer before more are dropped, and
+//the milliseconds between attempts to attach a viewer
+constexpr size_t STREAMRING = 1024;
+constexpr int STREAMWAIT = 100;
+//Members of an ensemble evaluated together, the lanes are padded to a multiple
+constexpr size_t BATCHLANES = 8;
+//Largest argument of which the ensemble kernel takes sin and cos without libm,
+//2^19 times pi/2 keeps the multiples of pi/2 it reduces by exact
+constexpr double WAVERANGE = 823549.6;
 
 #endif
@@ -0,0 +1,69 @@
+/******************************************************************************\
+*Header file for the CSV writer
+*Formats the simulation output with to_chars into one of two buffers while a
+*thread of its own writes the other one to the file, so the simulation does
+*not wait for the disk. A double is written exactly like an ostream with the
+*default precision writes it, the output is the same as with operator<<
+\******************************************************************************/
+#ifndef CSVWRITERH
+#define CSVWRITERH
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+
+class CsvWriter {
+public:
+	CsvWriter();
+	~CsvWriter();
+
+	CsvWriter(const CsvWriter&) = delete;
+	CsvWriter& operator=(const CsvWriter&) = delete;
+
+	bool open(const std::string& path);
+	bool close();
+
+	//a field followed by a comma
+	void field(double v);
+	void field(size_t v);
+	void field(std::string_view s);
+	void endRow();
+
+	//bytes written so far and the seconds from open to close
+	size_t getBytes() const {
+		return bytes;
+	}
+	double getSeconds() const {
+		return seconds;
+	}
+
+private:
+	void reserve(size_t n);
+	void flip();
+	void run();
+
+	std::ofstream out;
+	std::vector<char> front;
+	std::vector<char> back;
+	size_t used;
+	size_t backUsed;
+	size_t bytes;
+	double seconds;
+	std::chrono::steady_clock::time_point start;
+
+	std::thread writer;
+	std::mutex m;
+	std::condition_variable cv;
+	//back holds data the writer has not written yet
+	bool full;
+	bool stop;
+	bool failed;
+};
+
+#endif
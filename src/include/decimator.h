@@ -0,0 +1,59 @@
+/******************************************************************************\
+*Header file for the decimation of the simulation output
+*Picks the recorded globals out of each row of the simulation and thins the
+*rows out to one every so many steps. Sampled, the first row of every
+*interval is kept. With minMax every interval becomes two rows, at the time
+*of its first and its last step, holding the minimum and the maximum of each
+*global in the order they occurred, so peaks between the samples survive
+\******************************************************************************/
+#ifndef DECIMATORH
+#define DECIMATORH
+
+#include <vector>
+#include <cstddef>
+
+class Decimator {
+public:
+	//columns are the indices of the recorded values in a row of width values
+	Decimator(const std::vector<size_t>& columns, size_t width, size_t every, bool minMax);
+
+	//true when the row completed output rows
+	bool add(double time, const double* values);
+	//true when the steps of an unfinished interval were turned into rows
+	bool finish();
+
+	//the output rows for a simulation of steps steps
+	size_t outputRows(size_t steps) const;
+
+	size_t getRows() const {
+		return rows;
+	}
+	double getTime(size_t r) const {
+		return times[r];
+	}
+	const double* getValues(size_t r) const {
+		return out + r * columns.size();
+	}
+
+private:
+	void select(const double* values);
+	void emit();
+
+	std::vector<size_t> columns;
+	bool all;
+	size_t every;
+	bool minMax;
+	//steps of the current interval and the rows ready
+	size_t count;
+	size_t rows;
+	double times[2];
+	const double* out;
+	std::vector<double> picked;
+	//extremes of the current interval and the steps they were taken at
+	std::vector<double> lo;
+	std::vector<double> hi;
+	std::vector<size_t> loAt;
+	std::vector<size_t> hiAt;
+};
+
+#endif
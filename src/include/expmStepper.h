@@ -0,0 +1,30 @@
+/******************************************************************************\
+*Header file for the matrix exponential stepper
+*Steps an affine system x' = A x + b exactly: over a step h with b constant
+*x(t + h) = E x(t) + F b, with E = exp(A h) and F the integral of exp(A s)
+*from 0 to h. Both are dense and computed once, by scaling and squaring
+\******************************************************************************/
+#ifndef EXPMSTEPPERH
+#define EXPMSTEPPERH
+
+#include <vector>
+#include <cstdint>
+
+class ExpmStepper {
+public:
+	ExpmStepper() : n(0) {}
+
+	void init(const std::vector<uint32_t>& rows,
+						const std::vector<uint32_t>& cols,
+						const std::vector<double>& vals,
+						double h);
+	void step(std::vector<double>& x, const std::vector<double>& b);
+
+private:
+	size_t n;
+	std::vector<double> E;
+	std::vector<double> F;
+	std::vector<double> next;
+};
+
+#endif
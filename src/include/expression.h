@@ -1,14 +1,21 @@
 /******************************************************************************\
 *Header file for the expression class
-*Expressions are parsed into an abstract syntax tree
-*
+*Expressions are parsed into an abstract syntax tree whose nodes are kept in
+*the NodeArena of their system
 \******************************************************************************/
 #ifndef EXPRH
 #define EXPRH
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <ostream>
+
+#include "cacheIO.h"
+#include "nodeArena.h"
+#include "bytecode.h"
 
 struct var {
 	std::string name;
@@ -17,6 +24,12 @@ struct var {
 	double delta;
 };
 
+//CABs an FPAA configuration would take as a tree against the ones emitted
+struct CABCount {
+	size_t tree;
+	size_t emitted;
+};
+
 struct global_var {
 	std::string local_name;
 	std::string name;
@@ -25,96 +38,116 @@ struct global_var {
 	double delta;
 };
 
-enum class NodeType {
-	NUM,
-	VAR,
-	INTEG,
-	WAVE,
-	OP,
-};
-
-struct Node {
-	int num;
-	NodeType op;
-
-	double value;					//if the node is a num
-	std::string name;				//if the node is a variable
-	char oper;
+//Values and scalars of one kind of slot, indexed by the slot of a bound var
+struct SlotArray {
+	std::vector<double> value;
+	std::vector<double> rho;
+	std::vector<double> delta;
 
-	Node* left;
-	Node* right;
+	void assign(const std::vector<var>& v);
+	void assign(const std::vector<global_var>& v);
+};
 
-	//Constructors for the various node types
-	Node(NodeType o, int n) : num(n), op(o), left(nullptr), right(nullptr) {}
-	Node(char c, int n) : num(n), op(NodeType::OP), oper(c), left(nullptr), right(nullptr) {}
-	Node(NodeType o, char c, int n) : num(n), op(o), oper(c), left(nullptr), right(nullptr) {}
-	Node(double v, int n) : num(n), op(NodeType::NUM), value(v), left(nullptr), right(nullptr) {}
-	Node(std::string n, int c) : num(c), op(NodeType::VAR), name(n), left(nullptr), right(nullptr) {}
+/*
+*		Everything an expression reads while being evaluated, built once per
+*		system so evaluating does not allocate. The globals are shared between
+*		the systems
+*/
+struct EvalContext {
+	SlotArray constants;
+	SlotArray locals;
+	SlotArray* globals;
+
+	EvalContext(const std::vector<var>& c, const std::vector<var>& v, SlotArray* g) : globals(g) {
+		constants.assign(c);
+		locals.assign(v);
+	}
 };
 
 class Expr {
 public:
-	Expr() : root(nullptr), initCondit(0.0), rho(0.0), delta(0.0){}
-	~Expr() {
-		removeTree(root);
-	}
+	Expr(NodeArena* a) : arena(a), root(NONODE), initCondit(0.0), rho(0.0), delta(0.0){}
 
-	void print();
+	void print(std::ostream& os);
 
-	void parse(std::string e);
+	void parse(std::string_view e);
 
-	double Evaluate(const std::vector<var> constants,
-					const std::vector<var> vars,
-					const std::vector<global_var> global);
+	double Evaluate(const EvalContext& ctx);
+	double EvaluateTree(const EvalContext& ctx);
+	double EvaluateCode(const EvalContext& ctx);
 
 	bool isInteg();
 
+	void resolve(const std::vector<Slot>& symbols);
+	void compile(const std::vector<var>& constants,
+							 const std::vector<var>& vars,
+							 const std::vector<global_var>& global);
+	size_t codeSize();
+
 	void setScalar(std::pair<double,double> i);
+	double scaleInit(double v);
 	
 	void FPAAPrintConfig(std::ofstream &of, 
 						 const int c, const std::vector<var> constants,
 						 const std::vector<var> vars,
 						 const std::vector<global_var> global,
-						 const std::string exprName);
+						 const std::string exprName,
+						 CABCount& count);
+
+	void serialize(CacheWriter& w) const;
+	void deserialize(CacheReader& r);
+	void relocate(NodeArena* a, NodeId offset);
 
 	double getInit();
 	double getRho();
 	double getDelta();
-	Node* getRoot();
+	NodeId getRoot();
+	NodeArena* getArena();
 
 private:
-	Node* parseTree(std::string e);
-	Node* root;
-	std::vector<std::string> tokenise(const std::string e);
-	std::vector<std::string> prefixToPolish(std::vector<std::string> v);
-	Node* buildTree(std::vector<std::string>& tokens);
+	NodeArena* arena;
+	NodeId root;
+	NodeId parseBinary(std::string_view e, size_t& pos, int minPrec, int& c);
+	NodeId parseUnary(std::string_view e, size_t& pos, int& c);
+	NodeId parsePrimary(std::string_view e, size_t& pos, int& c);
 
-	void removeTree(Node* r);
+	void printTree(std::ostream& os, NodeId r);
 
-	void printTree(Node* r);
+	void emitCode(NodeId id, bool scaled, size_t depth,
+								const std::vector<var>& constants,
+								const std::vector<var>& vars,
+								const std::vector<global_var>& global);
 
-	double EvaluateBU(const std::vector<var>& vars, const std::vector<var>& constants, Node* r);
-	double EvaluateBUScaled(const std::vector<var>& vars, const std::vector<var>& constants, Node* r);
+	double EvaluateBU(const EvalContext& ctx, NodeId id);
+	double EvaluateBUScaled(const EvalContext& ctx, NodeId id);
 
 	std::unordered_map<std::string, std::string> FPAASetInputs(std::ofstream &of, 
 										 																				 const int c, 
+										 																				 NodeId r,
 										 																				 const std::vector<var> constants);
 	void FPAASetOutputs(std::ofstream &of,
 											const int c,
 											const std::vector<global_var> global,
 											const std::string exprName);
 	void FPAASetCABs(std::ofstream &of, 
-									 Node* r,
-									 const std::unordered_map<std::string, std::string> inputMap);
-	void returnLeaves(Node* r, std::vector<Node*> &inp);
+									 NodeId id,
+									 const std::unordered_map<std::string, std::string> inputMap,
+									 std::unordered_set<NodeId> &emitted);
+	void returnLeaves(NodeId r, std::vector<NodeId> &inp, std::unordered_set<NodeId> &seen);
+	NodeId foldTree(NodeId id, const std::vector<var>& constants, NodeTable& shared,
+									bool& isConst, double& value);
+	NodeId share(NodeId id, NodeTable& shared);
+	size_t countCABs(NodeId id);
 	void FPAAPrintInputVariables(std::ofstream &of, 
-															 Node* r, 
+															 NodeId id, 
 															 const std::unordered_map<std::string, std::string> inputMap);
 
-	std::vector<std::string> tokens{};
 	double initCondit;
 	double rho;
 	double delta;
+
+	std::vector<Instr> code;
+	std::vector<double> stack;
 };
 
 #endif
\ No newline at end of file
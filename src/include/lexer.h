@@ -0,0 +1,73 @@
+/******************************************************************************\
+*Header file for the lexer of the .ode input format
+*The whole input is tokenised in a single pass, every token carries the
+*line and column it started at so parse errors can point at the input.
+*Tokens are views into the input, which has to outlive them
+\******************************************************************************/
+#ifndef LEXERH
+#define LEXERH
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+enum class TokenType {
+	IDENT,
+	NUMBER,
+	LBRACE,
+	RBRACE,
+	LBRACKET,
+	RBRACKET,
+	EQUALS,
+	SEMICOLON,
+	COMMA,
+	TEXT,
+	END,
+};
+
+struct Token {
+	TokenType type;
+	std::string_view text;				//slice of the input
+	double value;					//if the token is a number
+	int line;
+	int col;
+};
+
+class ParseError : public std::invalid_argument {
+public:
+	ParseError(const std::string& msg, int l, int c)
+		: std::invalid_argument(msg), line(l), col(c) {}
+
+	int line;
+	int col;
+};
+
+class Lexer {
+public:
+	Lexer(std::string_view s, int l = 1, int c = 1) : src(s), pos(0), lookStart(0), line(l), col(c) {
+		lookahead = lex();
+	}
+
+	Token next();
+	const Token& peek() const;
+
+	Token expect(TokenType t, const std::string& what);
+	Token expectKeyword(const std::string& kw);
+
+	Token statementText();
+
+private:
+	Token lex();
+	void skipWhitespace();
+	void advance();
+	Token makeToken(TokenType t, size_t start, int l, int c);
+
+	std::string_view src;
+	size_t pos;
+	size_t lookStart;
+	int line;
+	int col;
+	Token lookahead;
+};
+
+#endif
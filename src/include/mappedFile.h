@@ -0,0 +1,33 @@
+/******************************************************************************\
+*Header file for read-only memory mapped input files
+*The contents are exposed as a string_view so the parser can work on the
+*file without copying it, files which can't be mapped are read into memory
+\******************************************************************************/
+#ifndef MAPPEDFILEH
+#define MAPPEDFILEH
+
+#include <string>
+#include <string_view>
+
+class MappedFile {
+public:
+	MappedFile() : data(nullptr), size(0) {}
+	~MappedFile() {
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+
+	std::string_view view() const;
+
+private:
+	const char* data;
+	size_t size;
+	std::string fallback;
+};
+
+#endif
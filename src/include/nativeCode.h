@@ -0,0 +1,41 @@
+/******************************************************************************\
+*Header file for the native right hand side
+*The DAGs of all systems are written out as C++, compiled into a shared
+*object with the system compiler and loaded with dlopen. Objects are cached
+*in the private odec-native directory of the user's cache by the hash of
+*their source, so an unchanged system is only compiled once
+\******************************************************************************/
+#ifndef NATIVECODEH
+#define NATIVECODEH
+
+#include <vector>
+#include <string>
+
+#include "systemCode.h"
+
+typedef int (*NativeRHS)(const double* locals, const double* globals, double* dxdt);
+
+class NativeCode {
+public:
+	NativeCode() : handle(nullptr) {}
+	~NativeCode();
+
+	NativeCode(const NativeCode&) = delete;
+	NativeCode& operator=(const NativeCode&) = delete;
+
+	bool load(const std::vector<SystemCode>& codes, const bool d);
+
+	bool isLoaded() const {
+		return handle != nullptr;
+	}
+
+	void run(size_t k, const EvalContext& ctx, std::vector<double>& dxdt) const;
+
+private:
+	bool compile(const std::string& src, const std::string& obj, const bool d);
+
+	void* handle;
+	std::vector<NativeRHS> functions;
+};
+
+#endif
@@ -0,0 +1,135 @@
+/******************************************************************************\
+*Header file for the node arena
+*All expression nodes of a system live in one contiguous array, children are
+*referred to by index and variable names are interned so a node stays small.
+*Before simulation every variable node is bound to the slot holding its value
+\******************************************************************************/
+#ifndef NODEARENAH
+#define NODEARENAH
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+enum class NodeType : uint8_t {
+	NUM,
+	VAR,
+	INTEG,
+	WAVE,
+	OP,
+};
+
+//Which value array a variable node reads from
+enum class SlotKind : uint8_t {
+	NONE,
+	CONSTANT,
+	LOCAL,
+	GLOBAL,
+};
+
+struct Slot {
+	SlotKind kind;
+	uint32_t index;
+};
+
+typedef uint32_t NodeId;
+constexpr NodeId NONODE = UINT32_MAX;
+constexpr uint32_t NONAME = UINT32_MAX;
+
+struct Node {
+	NodeType op;
+	char oper;						//if the node is an operation or wave
+	SlotKind kind;				//if the node is a bound variable
+	int32_t num;
+
+	NodeId left;
+	NodeId right;
+
+	union {
+		double value;				//if the node is a num
+		struct {
+			uint32_t name;		//interned name if the node is a variable
+			uint32_t slot;		//index into the value array given by kind
+		};
+	};
+
+	//Constructors for the various node types
+	Node(NodeType o, int n) : op(o), oper('\0'), kind(SlotKind::NONE), num(n), left(NONODE), right(NONODE), value(0.0) {}
+	Node(char c, int n) : op(NodeType::OP), oper(c), kind(SlotKind::NONE), num(n), left(NONODE), right(NONODE), value(0.0) {}
+	Node(NodeType o, char c, int n) : op(o), oper(c), kind(SlotKind::NONE), num(n), left(NONODE), right(NONODE), value(0.0) {}
+	Node(double v, int n) : op(NodeType::NUM), oper('\0'), kind(SlotKind::NONE), num(n), left(NONODE), right(NONODE), value(v) {}
+};
+
+//Hash and equality of the shape of a node, its number is not part of it
+struct NodeShape {
+	size_t operator()(const Node& n) const {
+		uint64_t v;
+		std::memcpy(&v, &n.value, sizeof(v));
+		uint64_t h = (static_cast<uint64_t>(n.op) << 8) | static_cast<unsigned char>(n.oper);
+		h = h * 0x9e3779b97f4a7c15ULL + n.left;
+		h = h * 0x9e3779b97f4a7c15ULL + n.right;
+		h = h * 0x9e3779b97f4a7c15ULL + v;
+		return h ^ (h >> 29);
+	}
+};
+
+struct SameShape {
+	bool operator()(const Node& a, const Node& b) const {
+		return a.op == b.op && a.oper == b.oper && a.left == b.left && a.right == b.right &&
+					 std::memcmp(&a.value, &b.value, sizeof(a.value)) == 0;
+	}
+};
+
+typedef std::unordered_map<Node, NodeId, NodeShape, SameShape> NodeTable;
+
+class NodeArena {
+public:
+	NodeId add(const Node& n) {
+		nodes.push_back(n);
+		return nodes.size() - 1;
+	}
+	NodeId addVar(std::string_view name, int num);
+
+	Node& operator[](NodeId i) {
+		return nodes[i];
+	}
+	const Node& operator[](NodeId i) const {
+		return nodes[i];
+	}
+
+	uint32_t intern(std::string_view name);
+	uint32_t find(std::string_view name) const;
+	const std::string& nameOf(uint32_t id) const {
+		return names[id];
+	}
+
+	size_t size() const {
+		return nodes.size();
+	}
+	size_t nameCount() const {
+		return names.size();
+	}
+	void reserve(size_t n) {
+		nodes.reserve(n);
+	}
+
+	NodeId append(NodeArena&& other);
+	void clear();
+
+	const Node* data() const {
+		return nodes.data();
+	}
+	void assign(const Node* n, size_t count);
+
+private:
+	std::vector<Node> nodes;
+	//deque keeps the strings in place so the map can hold views of them
+	std::deque<std::string> names;
+	std::unordered_map<std::string_view, uint32_t> nameIds;
+};
+
+#endif
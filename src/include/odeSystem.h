@@ -3,10 +3,14 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <cstdint>
 #include <unordered_map>
+#include <ostream>
 
 #include "expression.h"
+#include "lexer.h"
 
 struct ODE {
 	//Name of a variable
@@ -17,6 +21,47 @@ struct ODE {
 	std::vector<std::pair<double, double>> interval;
 	//Time duration of the ODE
 	double time;
+	//Emitted variables as (local name, global name)
+	std::vector<std::pair<std::string, std::string>> emits;
+};
+
+//Stepper used by the digital simulation
+enum class Method {
+	RK4,
+	DOPRI5,
+	ROSENBROCK,
+	EXPM
+};
+
+//Format of the simulation output, CSV or the columns of doubles or floats
+enum class Output {
+	CSV,
+	F64,
+	F32
+};
+
+struct SimulationOptions {
+	Method method;
+	//compile the right hand side to native code
+	bool native;
+	//tolerances of the steppers with step size control
+	double absTol;
+	double relTol;
+	//threads stepping independent systems and chunks of large ones, 0 for all cores
+	size_t threads;
+	//pass the globals between the systems through rings instead of stepping in lock-step
+	bool pipeline;
+	Output output;
+	//the recorded globals, all when empty, and the time between the rows,
+	//every step when below STEPPER
+	std::vector<std::string> signals;
+	double interval;
+	//keep the minimum and maximum over each interval instead of sampling it
+	bool minMax;
+	//write the level of detail pyramid of the recorded rows next to the output
+	bool lod;
+	//publish the recorded rows live to - for stdout, a FIFO or a Unix domain socket
+	std::string stream;
 };
 
 struct scalars {
@@ -34,35 +79,52 @@ public:
 		}
 	}
 
-	int readODESystem(std::ifstream& inp, 
+	int readODESystem(std::string_view src, 
 										const bool scaled, 
 										const bool clustering,
 										const bool d);
 
-	std::string parseVar(std::string& inp);
-	std::pair<double, double> parseInterval(std::string &inp);
-	double parseTime(std::string &inp);
-	void parseEmit(std::string &inp);
-	void setScalars(ODE o);
+	ODE parseSystem(Lexer& lex, NodeArena& nodes);
+	void parseVar(Lexer& lex, ODE& ode, NodeArena& nodes);
+	void parseInterval(Lexer& lex, 
+										 std::unordered_map<std::string, std::pair<double, double>>& intervals);
+	double parseTime(Lexer& lex);
+	void parseEmit(Lexer& lex, ODE& ode);
+	void addGlobals(const ODE& ode);
+	void setScalars(const ODE& o, std::ostream& out);
 
-	void simulate();
+	bool simulate(const bool d, const SimulationOptions& opts);
+	bool simulateEnsemble(const std::string& table, const bool d);
+	void benchmark(std::ostream& out);
 
 	std::vector<var> extractConstants(const ODE& ode) const;
 	std::vector<var> extractVariables(const ODE& ode) const;
 	std::vector<global_var> extractGlobals() const;
 	std::vector<Expr*> extractVariablesInteg(const ODE& ode) const;
+	void bindSymbols(const ODE& ode,
+									 const std::vector<var>& constants,
+									 const std::vector<var>& vars,
+									 const std::vector<global_var>& global);
+
+	static uint64_t hashContent(std::string_view src);
+	bool readCache(const std::string& path, uint64_t hash, uint8_t flags);
+	bool writeCache(const std::string& path, uint64_t hash, uint8_t flags) const;
 
-	void parseFPAAOutput();
+	void parseFPAAOutput(const bool d);
 	bool setInpFileName(const std::string i);
 	std::string getInpFileName();
 
-	int editTreeDistance(const Node* root1, const Node* root2);
+	int editTreeDistance(const NodeArena& nodes, NodeId root1, NodeId root2);
 	std::vector<std::vector<int>> computeSimilarityMatrix(const std::vector<Expr*> vars);
-	ODE cluster(ODE ode);
+	ODE cluster(ODE ode, std::ostream& log);
 
 private:
 	std::vector<ODE> ODES;
+	//Nodes of every expression in ODES
+	NodeArena arena;
 	std::unordered_map<std::string, std::tuple<std::string, double, scalars>> global;
+	//Global names in the order they were first emitted, used to rebuild global
+	std::vector<std::string> globalOrder;
 	std::string systemName;
 };
 
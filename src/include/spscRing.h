@@ -0,0 +1,52 @@
+/******************************************************************************\
+*Header file for the single producer single consumer ring
+*A ring of fixed width entries one thread pushes and another one pops without
+*locks. The producer only moves the head and the consumer only the tail, an
+*entry is published by the release store of the head past it
+\******************************************************************************/
+#ifndef SPSCRINGH
+#define SPSCRINGH
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+class SpscRing {
+public:
+	SpscRing(size_t w, size_t c) : width(w), capacity(c), buf(w * c), head(0), tail(0) {}
+
+	SpscRing(const SpscRing&) = delete;
+	SpscRing& operator=(const SpscRing&) = delete;
+
+	//producer side, back is the entry the next push publishes
+	bool full() const {
+		return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire) >= capacity;
+	}
+	double* back() {
+		return buf.data() + head.load(std::memory_order_relaxed) % capacity * width;
+	}
+	void push() {
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	//consumer side, front is the oldest entry not popped yet
+	bool empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_relaxed);
+	}
+	const double* front() const {
+		return buf.data() + tail.load(std::memory_order_relaxed) % capacity * width;
+	}
+	void pop() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+	size_t width;
+	size_t capacity;
+	std::vector<double> buf;
+	//entries pushed and popped so far
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/******************************************************************************\
+*Header file for the step scheduler
+*The systems of a file are coupled through the globals they emit and read.
+*Two systems conflict when one writes a global the other reads or writes,
+*conflicting systems take each step in the order of the file, so they see
+*exactly the globals the sequential loop would show them. Any other systems
+*step at the same time, and may run ahead of each other by up to STEPRING steps.
+*When pipelined every system reads the globals from a view of its own, which
+*is filled from a ring per pair of systems with the values the sequential
+*loop would show it, so a consumer only waits for the steps of its producers
+\******************************************************************************/
+#ifndef STEPSCHEDULERH
+#define STEPSCHEDULERH
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <functional>
+
+#include "threadPool.h"
+#include "spscRing.h"
+
+class StepScheduler {
+public:
+	//step(i, s, out) takes step s of system i and writes what it emits to out
+	typedef std::function<void(size_t, size_t, double*)> Step;
+	//row(s, values) gets the values all systems emitted in step s, in order
+	typedef std::function<void(size_t, const double*)> Row;
+
+	StepScheduler(const std::vector<std::vector<uint32_t>>& reads,
+								const std::vector<std::vector<uint32_t>>& writes,
+								const std::vector<size_t>& emitted);
+
+	void pipeline(const std::vector<double*>& views);
+
+	size_t getConflicts() const {
+		return conflicts;
+	}
+	size_t getRings() const {
+		return edges.size();
+	}
+	bool isParallel() const;
+
+	void run(ThreadPool* pool, size_t steps, const Step& step, const Row& row);
+
+private:
+	//the globals a producer passes to a consumer, which reads them lag steps later
+	struct Edge {
+		size_t from;
+		size_t to;
+		size_t lag;
+		//the slots in the view of the consumer and their place in what the producer emits
+		std::vector<uint32_t> slots;
+		std::vector<size_t> emits;
+		std::unique_ptr<SpscRing> ring;
+	};
+
+	bool ready(size_t i) const;
+	void launch(size_t i);
+	void finish(size_t i, size_t s);
+	void writeRows();
+	void take(size_t i, size_t s);
+	void give(size_t i, const double* out);
+
+	std::vector<std::vector<uint32_t>> reads;
+	std::vector<std::vector<uint32_t>> writes;
+	//conflicting systems before and after every system
+	std::vector<std::vector<size_t>> before;
+	std::vector<std::vector<size_t>> after;
+	//when pipelined, the view of every system and the edges into and out of it
+	std::vector<double*> views;
+	std::vector<Edge> edges;
+	std::vector<std::vector<size_t>> inputs;
+	std::vector<std::vector<size_t>> outputs;
+	std::vector<size_t> offset;
+	size_t width;
+	size_t conflicts;
+
+	//state of a parallel run
+	ThreadPool* pool;
+	size_t steps;
+	const Step* step;
+	const Row* row;
+	std::unique_ptr<std::atomic<size_t>[]> done;
+	std::unique_ptr<std::atomic<bool>[]> queued;
+	std::unique_ptr<std::atomic<size_t>[]> remaining;
+	std::vector<double> rows;
+	std::atomic<size_t> written;
+	std::mutex writeMutex;
+};
+
+#endif
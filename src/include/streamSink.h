@@ -0,0 +1,88 @@
+/******************************************************************************\
+*Header file for the live stream of the simulation output
+*Publishes the recorded rows as binary frames to stdout, a FIFO or a Unix
+*domain socket a viewer listens on. The simulation pushes a frame into a
+*ring and a thread of its own writes them out; when the viewer falls behind
+*and the ring is full the frame is dropped, the simulation never waits.
+*While no viewer is attached the frames are dropped as well and the thread
+*tries to attach again, every attach starts with the header:
+*
+*  magic      8 bytes "ODESTRM1"
+*  columns    uint32
+*  frameSize  uint32, bytes of every frame
+*  names      per column an uint32 length and the bytes of the name
+*
+*then frames of an uint64 sequence number of the row, its time and a double
+*per column. A gap in the sequence numbers shows dropped frames, the last
+*frame has the sequence number 2^64 - 1. All numbers are in the byte order
+*of the machine which wrote them
+\******************************************************************************/
+#ifndef STREAMSINKH
+#define STREAMSINKH
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "spscRing.h"
+
+struct StreamHeader {
+	char magic[8];
+	uint32_t columns;
+	uint32_t frameSize;
+};
+
+class StreamSink {
+public:
+	StreamSink() : socket(false), lost(false), made(false), fd(-1), columns(0), sequence(0), sent(0), dropped(0), discarded(0), stop(false) {}
+	~StreamSink() {
+		close();
+	}
+
+	StreamSink(const StreamSink&) = delete;
+	StreamSink& operator=(const StreamSink&) = delete;
+
+	//target is - for stdout or the path of a FIFO, made if it does not exist
+	//and removed by close, or of a listening Unix domain socket
+	bool open(const std::string& target, const std::vector<std::string>& names);
+	//the time and one value per column, dropped when the ring is full
+	void row(double time, const double* values);
+	void close();
+
+	size_t getSent() const {
+		return sent;
+	}
+	size_t getDropped() const {
+		return dropped + discarded;
+	}
+
+private:
+	bool attach();
+	void detach();
+	bool send(const void* p, size_t n);
+	void run();
+
+	std::string target;
+	bool socket;
+	//stdout was closed by its reader, it can not be attached again
+	bool lost;
+	//the FIFO was made by open
+	bool made;
+	int fd;
+	size_t columns;
+	std::vector<char> head;
+	std::unique_ptr<SpscRing> ring;
+	//rows pushed or dropped by the simulation, frames written or thrown away by the thread
+	uint64_t sequence;
+	size_t sent;
+	size_t dropped;
+	size_t discarded;
+	std::thread writer;
+	std::atomic<bool> stop;
+};
+
+#endif
@@ -0,0 +1,189 @@
+/******************************************************************************\
+*Header file for the compiled right hand side of a system
+*The expressions of a system are merged into one hash-consed DAG, a subterm
+*which occurs in several expressions, or several times in one, becomes a
+*single register which is computed once per evaluation of the right hand side
+\******************************************************************************/
+#ifndef SYSTEMCODEH
+#define SYSTEMCODEH
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <unordered_map>
+
+#include "expression.h"
+#include "bytecode.h"
+
+class ThreadPool;
+
+struct DagInstr {
+	OpCode op;
+	uint32_t dst;
+	uint32_t a;					//operand register, or slot for loads
+	uint32_t b;					//operand register
+	double x;						//rho for scaled loads
+	double y;						//delta for scaled loads
+};
+
+/*
+*		The values of all members of an ensemble, slot major so the lanes of one
+*		slot are contiguous. lanes is a multiple of BATCHLANES
+*/
+struct BatchContext {
+	size_t lanes;
+	std::vector<double> constants;
+	std::vector<double> locals;
+	std::vector<double>* globals;
+};
+
+class SystemCode {
+public:
+	SystemCode() : rhsEnd(0), linear(false), linStale(true), batchLanes(0), pool(nullptr),
+								 foldConstants(true), treeNodes(0) {}
+
+	void build(const std::vector<Expr*>& exprs,
+						 const std::vector<var>& constants,
+						 const std::vector<var>& vars,
+						 const std::vector<global_var>& global,
+						 const bool fold = true);
+
+	void run(const EvalContext& ctx, std::vector<double>& dxdt);
+	void runBatch(const BatchContext& ctx, std::vector<double>& dxdt);
+	//sin (oper s) or cos of n values as runBatch takes them, n a multiple of BATCHLANES
+	static void runWave(char oper, const double* a, double* d, size_t n);
+
+	//Evaluate the right hand side of a large system in chunks on the pool
+	size_t partition();
+	void setPool(ThreadPool* p) {
+		pool = p;
+	}
+
+	void buildJacobian();
+	void runJacobian(const EvalContext& ctx, std::vector<double>& dxdt, std::vector<double>& jac);
+
+	//Recognise a right hand side A x + b which is affine in the integrated vars,
+	//run then evaluates it as a sparse matrix vector product
+	bool buildLinear();
+	const std::vector<double>& offset(const EvalContext& ctx);
+	bool isLinear() const {
+		return linear;
+	}
+	//A in compressed rows like the Jacobian, in the units of dxdt
+	const std::vector<uint32_t>& getLinRows() const {
+		return linRows;
+	}
+	const std::vector<uint32_t>& getLinCols() const {
+		return linCols;
+	}
+	const std::vector<double>& getLinVals() const {
+		return linVals;
+	}
+
+	//Sparsity pattern of the Jacobian in compressed rows, the entries of row i
+	//are jac[jacRows[i]] to jac[jacRows[i + 1]], in the columns jacCols
+	const std::vector<uint32_t>& getJacRows() const {
+		return jacRows;
+	}
+	const std::vector<uint32_t>& getJacCols() const {
+		return jacCols;
+	}
+	size_t getJacNonZeros() const {
+		return jacCols.size();
+	}
+
+	std::vector<uint32_t> globalsRead() const;
+
+	void emitSource(std::ostream& os, const std::string& fn) const;
+
+	//Nodes in the trees of the expressions against nodes left in the DAG
+	size_t getTreeNodes() const {
+		return treeNodes;
+	}
+	size_t getDagNodes() const {
+		return regs.size();
+	}
+	size_t getInstrCount() const {
+		return code.size();
+	}
+	size_t getSaved() const {
+		return treeNodes > regs.size() ? treeNodes - regs.size() : 0;
+	}
+	//Instructions of all chunks, a subterm shared by chunks is in each of them
+	size_t getChunkInstrCount() const;
+
+private:
+	struct Key {
+		OpCode op;
+		uint32_t a;
+		uint32_t b;
+		uint64_t bits;
+
+		bool operator==(const Key& o) const {
+			return op == o.op && a == o.a && b == o.b && bits == o.bits;
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key& k) const;
+	};
+	//the expressions first to last - 1 with the instructions they need, on
+	//registers of their own
+	struct Chunk {
+		size_t first;
+		size_t last;
+		std::vector<DagInstr> code;
+		std::vector<double> regs;
+		std::vector<uint32_t> outputs;
+	};
+
+	uint32_t node(const NodeArena& nodes, NodeId id, bool scaled, double rho, double delta,
+								const std::vector<var>& constants,
+								const std::vector<var>& vars,
+								const std::vector<global_var>& global);
+	uint32_t literal(double v);
+	uint32_t instr(OpCode op, uint32_t a, uint32_t b, double x = 0.0, double y = 0.0);
+	uint32_t derive(OpCode op, uint32_t a, uint32_t b);
+	void exec(size_t end, const EvalContext& ctx);
+	void outputsTo(std::vector<double>& dxdt) const;
+	void runChunk(Chunk& c, const EvalContext& ctx, std::vector<double>& dxdt) const;
+
+	std::vector<DagInstr> code;
+	std::vector<double> regs;
+	std::vector<char> isLiteral;
+	std::unordered_map<Key, uint32_t, KeyHash> table;
+
+	std::vector<uint32_t> outputs;
+	std::vector<double> outRho;
+	std::vector<double> outDelta;
+
+	//code up to rhsEnd computes the right hand side, the rest the Jacobian
+	size_t rhsEnd;
+	std::vector<uint32_t> jacRows;
+	std::vector<uint32_t> jacCols;
+	std::vector<uint32_t> jacRegs;
+
+	//A and b of an affine right hand side, b is evaluated again when a global
+	//it reads has changed
+	bool linear;
+	std::vector<uint32_t> linRows;
+	std::vector<uint32_t> linCols;
+	std::vector<double> linVals;
+	std::vector<double> linOffset;
+	std::vector<uint32_t> linReads;
+	std::vector<double> linSeen;
+	std::vector<double> linLocals;
+	bool linStale;
+
+	//registers of every lane for runBatch, register major
+	std::vector<double> batchRegs;
+	size_t batchLanes;
+
+	std::vector<Chunk> chunks;
+	ThreadPool* pool;
+
+	bool foldConstants;
+	size_t treeNodes;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/******************************************************************************\
+*Header file for the thread pool
+*A fixed set of workers which each keep a deque of tasks, a worker runs its
+*own tasks newest first and steals the oldest ones of the others when it has
+*none left. The thread which waits for the tasks helps running them
+\******************************************************************************/
+#ifndef THREADPOOLH
+#define THREADPOOLH
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+class ThreadPool {
+public:
+	explicit ThreadPool(size_t threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	//threads running tasks, the workers and the waiting thread
+	size_t size() const {
+		return workers.size() + 1;
+	}
+
+	void submit(std::function<void()> task);
+	void runUntil(const std::function<bool()>& done);
+	void parallelFor(size_t n, const std::function<void(size_t)>& body);
+	void wake();
+	bool hasFailed() const;
+
+private:
+	struct Queue {
+		std::mutex m;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	size_t self() const;
+	bool take(size_t q, std::function<void()>& task);
+	void runTask(std::function<void()>& task);
+	void work(size_t q);
+
+	std::vector<std::thread> workers;
+	//one queue per worker, the last one for the threads outside the pool
+	std::vector<std::unique_ptr<Queue>> queues;
+
+	std::mutex m;
+	std::condition_variable cv;
+	std::atomic<size_t> pending;
+	std::atomic<size_t> active;
+	std::atomic<bool> failed;
+	bool stop;
+	std::exception_ptr error;
+};
+
+#endif
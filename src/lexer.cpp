@@ -0,0 +1,188 @@
+#include <string>
+#include <cctype>
+#include <string_view>
+#include <charconv>
+
+#include "include/lexer.h"
+
+static std::string describe(const Token& t) {
+	if (t.type == TokenType::END) {
+		return "end of input";
+	}
+	return "'" + std::string(t.text) + "'";
+}
+
+void Lexer::advance() {
+	if (src[pos] == '\n') {
+		line += 1;
+		col = 1;
+	}
+	else {
+		col += 1;
+	}
+	pos += 1;
+}
+
+void Lexer::skipWhitespace() {
+	while (pos < src.size() && std::isspace((unsigned char)src[pos])) {
+		advance();
+	}
+}
+
+Token Lexer::makeToken(TokenType t, size_t start, int l, int c) {
+	Token tok;
+	tok.type = t;
+	tok.text = src.substr(start, pos - start);
+	tok.value = 0.0;
+	tok.line = l;
+	tok.col = c;
+	return tok;
+}
+
+/*
+*		Scan the next token starting at pos, numbers may carry a sign as in the
+*		interval bounds and may have an exponent
+*/
+Token Lexer::lex() {
+	skipWhitespace();
+
+	size_t start = pos;
+	int l = line;
+	int c = col;
+	lookStart = start;
+
+	if (pos >= src.size()) {
+		return makeToken(TokenType::END, start, l, c);
+	}
+
+	char ch = src[pos];
+	if (std::isalpha((unsigned char)ch) || ch == '_') {
+		while (pos < src.size() && (std::isalnum((unsigned char)src[pos]) || src[pos] == '_')) {
+			advance();
+		}
+		return makeToken(TokenType::IDENT, start, l, c);
+	}
+
+	bool sign = (ch == '+' || ch == '-') && pos + 1 < src.size();
+	size_t digit = sign ? pos + 1 : pos;
+	if (std::isdigit((unsigned char)src[digit]) ||
+			(src[digit] == '.' && digit + 1 < src.size() && std::isdigit((unsigned char)src[digit + 1]))) {
+		size_t end = digit;
+		while (end < src.size() && std::isdigit((unsigned char)src[end])) end += 1;
+		if (end < src.size() && src[end] == '.') end += 1;
+		while (end < src.size() && std::isdigit((unsigned char)src[end])) end += 1;
+		if (end < src.size() && (src[end] == 'e' || src[end] == 'E')) {
+			size_t exp = end + 1;
+			if (exp < src.size() && (src[exp] == '+' || src[exp] == '-')) exp += 1;
+			if (exp < src.size() && std::isdigit((unsigned char)src[exp])) {
+				end = exp;
+				while (end < src.size() && std::isdigit((unsigned char)src[end])) end += 1;
+			}
+		}
+
+		double v;
+		size_t from = (ch == '+') ? pos + 1 : pos;
+		auto [p, ec] = std::from_chars(src.data() + from, src.data() + end, v);
+		if (ec != std::errc() || p != src.data() + end) {
+			std::string text(src.substr(start, end - start));
+			throw ParseError(ec == std::errc::result_out_of_range ? "number " + text + " is out of range"
+																														: "invalid number " + text, l, c);
+		}
+		while (pos < end) {
+			advance();
+		}
+		Token tok = makeToken(TokenType::NUMBER, start, l, c);
+		tok.value = v;
+		return tok;
+	}
+
+	TokenType t;
+	switch (ch) {
+	case '{':
+		t = TokenType::LBRACE;
+		break;
+	case '}':
+		t = TokenType::RBRACE;
+		break;
+	case '[':
+		t = TokenType::LBRACKET;
+		break;
+	case ']':
+		t = TokenType::RBRACKET;
+		break;
+	case '=':
+		t = TokenType::EQUALS;
+		break;
+	case ';':
+		t = TokenType::SEMICOLON;
+		break;
+	case ',':
+		t = TokenType::COMMA;
+		break;
+	default:
+		t = TokenType::TEXT;
+		break;
+	}
+	advance();
+	return makeToken(t, start, l, c);
+}
+
+Token Lexer::next() {
+	Token t = lookahead;
+	if (t.type != TokenType::END) {
+		lookahead = lex();
+	}
+	return t;
+}
+
+const Token& Lexer::peek() const {
+	return lookahead;
+}
+
+Token Lexer::expect(TokenType t, const std::string& what) {
+	if (lookahead.type != t) {
+		throw ParseError("expected " + what + " but found " + describe(lookahead),
+										 lookahead.line, lookahead.col);
+	}
+	return next();
+}
+
+Token Lexer::expectKeyword(const std::string& kw) {
+	if (lookahead.type != TokenType::IDENT || lookahead.text != kw) {
+		throw ParseError("expected '" + kw + "' but found " + describe(lookahead),
+										 lookahead.line, lookahead.col);
+	}
+	return next();
+}
+
+/*
+*		Return the raw text from the current token up to the next ';' so that the
+*		right hand side of a var can be handed to the expression parser
+*/
+Token Lexer::statementText() {
+	pos = lookStart;
+	line = lookahead.line;
+	col = lookahead.col;
+
+	size_t start = pos;
+	while (pos < src.size() && src[pos] != ';') {
+		advance();
+	}
+	if (pos >= src.size()) {
+		throw ParseError("missing ';' at end of statement", lookahead.line, lookahead.col);
+	}
+
+	size_t end = pos;
+	while (end > start && std::isspace((unsigned char)src[end - 1])) {
+		end -= 1;
+	}
+	Token tok;
+	tok.type = TokenType::TEXT;
+	tok.text = src.substr(start, end - start);
+	tok.value = 0.0;
+	tok.line = lookahead.line;
+	tok.col = lookahead.col;
+
+	lookahead = lex();
+	return tok;
+}
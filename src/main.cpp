@@ -1,22 +1,58 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <algorithm>
 
 #include <getopt.h>
 
 #include "include/odeSystem.h"
+#include "include/mappedFile.h"
+#include "include/constants.h"
 
 static void
 showHelp(const char *progName)
 {
-  std::cerr << progName << " {-n|-s} {-k} {-i} {-o} {-d} [filename ...]\n";
+  std::cerr << progName << " {-n|-s} {-k} {-i} {-m method} {-a tol} {-r tol} {-p threads} {-l} {-f format} {-g globals} {-t interval} {-x} {-z} {-w target} {-j} {-e table} {-o} {-b} {-c} {-d} [filename ...]\n";
   std::cerr <<
 R"HERE(
     -n           No scaling performed.
     -s           Scale variables according to defined FPAALIM in constants.h.
     -k           Compare and cluster the expressions in order to minimise configuration changes
-    -i           Digitally simulate the read system of ODEs.
+    -i           Digitally simulate the read system of ODEs. A linear system
+                 is evaluated as A x + b, which can differ from the
+                 expressions in the last bits.
+    -m method    Stepper of the simulation, rk4 (default) with a fixed step,
+                 dopri5 with step size control, rosenbrock, an implicit
+                 stepper with step size control for stiff systems which uses
+                 the symbolic Jacobian, or expm, which steps linear systems
+                 exactly with their matrix exponential and others with rk4.
+    -a tol       Absolute tolerance of dopri5 and rosenbrock.
+    -r tol       Relative tolerance of dopri5 and rosenbrock.
+    -p threads   Threads stepping systems which share no globals at the same
+                 time and evaluating the right hand side of large systems in
+                 chunks, all cores by default.
+    -l           Pipeline the systems, a system reading the globals of others
+                 only waits for the steps of those.
+    -f format    Format of the simulation output, csv (default) or the binary
+                 columns of f64 (doubles) or f32 (floats) in res/filename.bin.
+    -g globals   Record only the emitted globals of the comma separated list.
+    -t interval  Record one row every interval of time, rounded to a multiple
+                 of the step, instead of every step.
+    -x           With -t, record the minimum and maximum of every global over
+                 each interval as two rows instead of one sample.
+    -z           Write the minimum, maximum and mean of the recorded globals
+                 at successive 2x decimations to res/filename.lod for plotting.
+    -w target    Stream the recorded rows as binary frames to - (stdout), a
+                 FIFO or a Unix domain socket while simulating, frames a
+                 viewer is too slow for are dropped.
+    -j           Compile the right hand side to native code for the simulation,
+                 with the compiler in $CXX or c++, falls back to the interpreter.
+    -e table     Simulate an ensemble, one member per row of the CSV table. The
+                 header names the constants and integrated vars a row sets.
     -o           Parse the output into FPAA configuration format.
+    -b           Benchmark the evaluation of the right hand side of each system.
+    -c           Cache the compiled system next to the input (filename.odec)
+                 and reuse it while the input and flags are unchanged.
     -d           debug mode
 
     One of -n or -s must be specified.
@@ -35,9 +71,13 @@ int main(int argc, char* argv[]) {
   bool sim = 0;
   bool out = 0;
   bool debug = 0;
+  bool cache = 0;
+  bool bench = 0;
+  SimulationOptions opts{Method::RK4, false, ABSTOL, RELTOL, 0, false, Output::CSV, {}, 0.0, false, false, {}};
   std::string inpFile;
+  std::string ensemble;
 
-  while ((c = getopt(argc, argv, "snkdioh")) != -1) {
+  while ((c = getopt(argc, argv, "snkdiohcbjlxze:m:a:r:p:f:g:t:w:")) != -1) {
   	switch(c) {
   	case 's':
   		scaling = 1;
@@ -57,9 +97,117 @@ int main(int argc, char* argv[]) {
     case 'd':
       debug = 1;
       break;
+    case 'c':
+      cache = 1;
+      break;
+    case 'b':
+      bench = 1;
+      break;
+    case 'j':
+      opts.native = 1;
+      break;
+    case 'l':
+      opts.pipeline = 1;
+      break;
+    case 'e':
+      ensemble = optarg;
+      break;
+    case 'm':
+      if (std::string(optarg) == "rk4") {
+        opts.method = Method::RK4;
+      }
+      else if (std::string(optarg) == "dopri5") {
+        opts.method = Method::DOPRI5;
+      }
+      else if (std::string(optarg) == "rosenbrock") {
+        opts.method = Method::ROSENBROCK;
+      }
+      else if (std::string(optarg) == "expm") {
+        opts.method = Method::EXPM;
+      }
+      else {
+        std::cerr << "Unknown method " << optarg << '\n';
+        showHelp(progName);
+        return -1;
+      }
+      break;
+    case 'f':
+      if (std::string(optarg) == "csv") {
+        opts.output = Output::CSV;
+      }
+      else if (std::string(optarg) == "f64") {
+        opts.output = Output::F64;
+      }
+      else if (std::string(optarg) == "f32") {
+        opts.output = Output::F32;
+      }
+      else {
+        std::cerr << "Unknown format " << optarg << '\n';
+        showHelp(progName);
+        return -1;
+      }
+      break;
+    case 'g': {
+      std::string list = optarg;
+      size_t begin = 0;
+      while (begin <= list.size()) {
+        size_t end = std::min(list.find(',', begin), list.size());
+        if (end > begin) {
+          opts.signals.push_back(list.substr(begin, end - begin));
+        }
+        begin = end + 1;
+      }
+      break;
+    }
+    case 't': {
+      char* end;
+      double interval = std::strtod(optarg, &end);
+      if (*end != '\0' || !(interval > 0)) {
+        std::cerr << "Error: the output interval must be a positive number\n";
+        return -1;
+      }
+      opts.interval = interval;
+      break;
+    }
+    case 'x':
+      opts.minMax = 1;
+      break;
+    case 'z':
+      opts.lod = 1;
+      break;
+    case 'w':
+      opts.stream = optarg;
+      break;
+    case 'a':
+    case 'r': {
+      char* end;
+      double tol = std::strtod(optarg, &end);
+      if (*end != '\0' || !(tol > 0)) {
+        std::cerr << "Error: tolerance must be a positive number\n";
+        return -1;
+      }
+      if (c == 'a') {
+        opts.absTol = tol;
+      }
+      else {
+        opts.relTol = tol;
+      }
+      break;
+    }
+    case 'p': {
+      char* end;
+      long threads = std::strtol(optarg, &end, 10);
+      if (*end != '\0' || threads < 1) {
+        std::cerr << "Error: the number of threads must be a positive integer\n";
+        return -1;
+      }
+      opts.threads = threads;
+      break;
+    }
     case '?':
-      if (c == 't') {
-        std::cerr << "Time option requires an argument\n";
+      if (optopt == 'e' || optopt == 'm' || optopt == 'a' || optopt == 'r' || optopt == 'p' || optopt == 'f' ||
+          optopt == 'g' || optopt == 't' || optopt == 'w') {
+        std::cerr << "Option -" << (char)optopt << " requires an argument\n";
       }
       else {
         std::cerr << "Unkown option " << c << '\n';
@@ -71,6 +219,11 @@ int main(int argc, char* argv[]) {
   	}
   }
 
+  //stdout carries the stream, everything printed goes to stderr instead
+  if (opts.stream == "-") {
+    std::cout.rdbuf(std::cerr.rdbuf());
+  }
+
   if (optind < argc) {
       inpFile = argv[optind];
       optind++;
@@ -86,14 +239,14 @@ int main(int argc, char* argv[]) {
     showHelp(progName);
   	return -1;
   }
-  else if (!out && !sim) {
-    std::cerr << "Error: either output parsing or simulating has to be enabled\n";
+  else if (!out && !sim && !bench && ensemble.empty()) {
+    std::cerr << "Error: either output parsing, simulating, an ensemble or benchmarking has to be enabled\n";
     showHelp(progName);
     return -1;
   }
-	std::ifstream file(inpFile);
+	MappedFile file;
 
-	if (!file.is_open()) {
+	if (!file.open(inpFile)) {
 		std::cerr << "Error: failed to open file " << inpFile << '\n';
 		return -1;
 	}
@@ -104,16 +257,46 @@ int main(int argc, char* argv[]) {
     std::cerr << "Error: file must use .ode suffix\n";
     return -1;
   }
-	sys.readODESystem(file, scaling, clustering, debug);
+  uint64_t hash = 0;
+  uint8_t flags = (scaling ? 1 : 0) | (clustering ? 2 : 0);
+  std::string cacheFile = inpFile + "c";
+  bool cached = false;
+  if (cache) {
+    hash = ODESystem::hashContent(file.view());
+    cached = sys.readCache(cacheFile, hash, flags);
+    if (cached && debug) {
+      std::cerr << "Loaded compiled system from " << cacheFile << "\n\n";
+    }
+  }
+	if (!cached) {
+    if (sys.readODESystem(file.view(), scaling, clustering, debug) != 0) {
+      file.close();
+      return -1;
+    }
+    if (cache && !sys.writeCache(cacheFile, hash, flags)) {
+      std::cerr << "Warning: failed to write cache file " << cacheFile << '\n';
+    }
+  }
   file.close();
 
   if (out) {
-    sys.parseFPAAOutput();
+    sys.parseFPAAOutput(debug);
     std::cout << "Output placed in FPAAres/" << sys.getInpFileName() << ".FPAAconfig\n";
   }
   if (sim) {
-    sys.simulate();
-    std::cout << "Simulation output placed in res/" << sys.getInpFileName() << ".csv\n";
+    if (!sys.simulate(debug, opts)) {
+      return -1;
+    }
+    std::cout << "Simulation output placed in res/" << sys.getInpFileName() << (opts.output == Output::CSV ? ".csv\n" : ".bin\n");
+  }
+  if (!ensemble.empty()) {
+    if (!sys.simulateEnsemble(ensemble, debug)) {
+      return -1;
+    }
+    std::cout << "Ensemble output placed in res/" << sys.getInpFileName() << "_ensemble.csv\n";
+  }
+  if (bench) {
+    sys.benchmark(std::cout);
   }
 
 
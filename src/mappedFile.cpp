@@ -0,0 +1,57 @@
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <iterator>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "include/mappedFile.h"
+
+bool MappedFile::open(const std::string& path) {
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			data = static_cast<const char*>(p);
+			size = st.st_size;
+			::close(fd);
+			return true;
+		}
+	}
+	::close(fd);
+
+	// pipes, empty files or a failed mmap are read into memory instead
+	std::ifstream inp(path, std::ios::binary);
+	if (!inp.is_open()) {
+		return false;
+	}
+	fallback.assign(std::istreambuf_iterator<char>(inp), std::istreambuf_iterator<char>());
+	return true;
+}
+
+void MappedFile::close() {
+	if (data != nullptr) {
+		munmap(const_cast<char*>(data), size);
+		data = nullptr;
+		size = 0;
+	}
+	fallback.clear();
+}
+
+std::string_view MappedFile::view() const {
+	if (data != nullptr) {
+		return std::string_view(data, size);
+	}
+	return fallback;
+}
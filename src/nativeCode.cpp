@@ -0,0 +1,196 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <filesystem>
+#include <system_error>
+#include <cerrno>
+
+#include <dlfcn.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <sys/stat.h>
+
+#include "include/nativeCode.h"
+#include "include/odeSystem.h"
+
+static const char* NATIVEFLAGS = "-O2 -ffp-contract=off -shared -fPIC";
+
+NativeCode::~NativeCode() {
+	if (handle) {
+		dlclose(handle);
+	}
+}
+
+/*
+*		Quote a path for the shell
+*/
+static std::string quote(const std::string& s) {
+	std::string q = "'";
+	for (char c : s) {
+		if (c == '\'') {
+			q += "'\\''";
+		}
+		else {
+			q += c;
+		}
+	}
+	return q + "'";
+}
+
+bool NativeCode::compile(const std::string& src, const std::string& obj, const bool d) {
+	const char* env = std::getenv("CXX");
+	std::string cxx = (env && *env) ? env : "c++";
+	std::string tmp = obj + ".tmp" + std::to_string(getpid());
+
+	std::string cmd = cxx + " " + NATIVEFLAGS + " -o " + quote(tmp) + " " + quote(src);
+	if (!d) {
+		cmd += " 2>/dev/null";
+	}
+	if (d) {
+		std::cerr << "Compiling native RHS: " << cmd << '\n';
+	}
+	if (std::system(cmd.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+	//only the user may replace it, whatever the umask
+	if (chmod(tmp.c_str(), 0700) != 0 || std::rename(tmp.c_str(), obj.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+/*
+*		A directory or file nobody but the user can have put or changed there,
+*		links are not followed
+*/
+static bool ownedByUser(const std::string& path, bool directory) {
+	struct stat st;
+	if (lstat(path.c_str(), &st) != 0) {
+		return false;
+	}
+	if (directory ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) {
+		return false;
+	}
+	return st.st_uid == geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/*
+*		The cache of the user, $XDG_CACHE_HOME or ~/.cache, with odec-native
+*		made private to the user in it
+*/
+static bool cacheDir(std::filesystem::path& dir) {
+	const char* xdg = std::getenv("XDG_CACHE_HOME");
+	const char* home = std::getenv("HOME");
+	if (xdg && *xdg == '/') {
+		dir = xdg;
+	}
+	else if (home && *home == '/') {
+		dir = std::filesystem::path(home) / ".cache";
+	}
+	else if (const passwd* pw = getpwuid(geteuid())) {
+		dir = std::filesystem::path(pw->pw_dir) / ".cache";
+	}
+	else {
+		return false;
+	}
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	dir /= "odec-native";
+	if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+		return false;
+	}
+	return ownedByUser(dir.string(), true);
+}
+
+/*
+*		Generate, compile if it is not cached yet and load the native right hand
+*		sides of all systems, returns false if the interpreter has to be used
+*/
+bool NativeCode::load(const std::vector<SystemCode>& codes, const bool d) {
+	const char* env = std::getenv("CXX");
+	std::ostringstream src;
+	src << "// right hand sides generated by the ODE compiler, " << (env && *env ? env : "c++")
+			<< " " << NATIVEFLAGS << "\n";
+	src << "#include <cmath>\n#include <cstring>\n\n";
+	src << "static inline double bits(unsigned long long b) {\n"
+			<< "\tdouble d;\n\tstd::memcpy(&d, &b, sizeof(d));\n\treturn d;\n}\n\n";
+	for (size_t k = 0; k < codes.size(); k += 1) {
+		codes[k].emitSource(src, "ode_rhs_" + std::to_string(k));
+		src << '\n';
+	}
+	std::string text = src.str();
+
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx",
+								static_cast<unsigned long long>(ODESystem::hashContent(text)));
+
+	std::filesystem::path dir;
+	if (!cacheDir(dir)) {
+		if (d) {
+			std::cerr << "No private cache directory for the native RHS\n";
+		}
+		return false;
+	}
+	std::string obj = (dir / (std::string(name) + ".so")).string();
+
+	std::error_code ec;
+	if (!std::filesystem::exists(obj, ec)) {
+		//the source under a name of this process, the object is renamed into place
+		std::string srcFile = (dir / (std::string(name) + "." + std::to_string(getpid()) + ".cpp")).string();
+		std::ofstream of(srcFile);
+		of << text;
+		of.close();
+		bool compiled = of && compile(srcFile, obj, d);
+		std::remove(srcFile.c_str());
+		if (!compiled) {
+			return false;
+		}
+	}
+	else if (d) {
+		std::cerr << "Loaded native RHS from " << obj << '\n';
+	}
+
+	if (!ownedByUser(obj, false)) {
+		if (d) {
+			std::cerr << "Not loading " << obj << ", it can be written by other users\n";
+		}
+		return false;
+	}
+	handle = dlopen(obj.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		return false;
+	}
+	functions.clear();
+	for (size_t k = 0; k < codes.size(); k += 1) {
+		std::string fn = "ode_rhs_" + std::to_string(k);
+		NativeRHS f = reinterpret_cast<NativeRHS>(dlsym(handle, fn.c_str()));
+		if (!f) {
+			dlclose(handle);
+			handle = nullptr;
+			functions.clear();
+			return false;
+		}
+		functions.push_back(f);
+	}
+	return true;
+}
+
+void NativeCode::run(size_t k, const EvalContext& ctx, std::vector<double>& dxdt) const {
+	switch (functions[k](ctx.locals.value.data(), ctx.globals->value.data(), dxdt.data())) {
+	case 0:
+		return;
+	case 1:
+		throw std::invalid_argument("Division by 0 not possible\n");
+	case 2:
+		throw std::invalid_argument("Variable not found\n");
+	default:
+		throw std::invalid_argument("Operation not found\n");
+	}
+}
@@ -0,0 +1,69 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "include/nodeArena.h"
+
+uint32_t NodeArena::intern(std::string_view name) {
+	auto it = nameIds.find(name);
+	if (it != nameIds.end()) {
+		return it->second;
+	}
+	names.emplace_back(name);
+	uint32_t id = names.size() - 1;
+	nameIds.emplace(names.back(), id);
+	return id;
+}
+
+uint32_t NodeArena::find(std::string_view name) const {
+	auto it = nameIds.find(name);
+	if (it == nameIds.end()) {
+		return NONAME;
+	}
+	return it->second;
+}
+
+NodeId NodeArena::addVar(std::string_view name, int num) {
+	Node n(NodeType::VAR, num);
+	n.name = intern(name);
+	return add(n);
+}
+
+/*
+*		Move all nodes of other to the end of this arena, returns the offset that
+*		has to be added to node ids of other. An empty arena takes over the
+*		storage of other without copying
+*/
+NodeId NodeArena::append(NodeArena&& other) {
+	if (nodes.empty() && names.empty()) {
+		*this = std::move(other);
+		other.clear();
+		return 0;
+	}
+	NodeId offset = nodes.size();
+
+	std::vector<uint32_t> nameMap(other.names.size());
+	for (size_t i = 0; i < other.names.size(); i += 1) {
+		nameMap[i] = intern(other.names[i]);
+	}
+
+	for (Node n : other.nodes) {
+		if (n.left != NONODE) n.left += offset;
+		if (n.right != NONODE) n.right += offset;
+		if (n.op == NodeType::VAR) n.name = nameMap[n.name];
+		nodes.push_back(n);
+	}
+	other.clear();
+	return offset;
+}
+
+void NodeArena::assign(const Node* n, size_t count) {
+	nodes.assign(n, n + count);
+}
+
+void NodeArena::clear() {
+	nodes.clear();
+	nodes.shrink_to_fit();
+	nameIds.clear();
+	names.clear();
+}
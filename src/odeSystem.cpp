@@ -7,6 +7,12 @@
 #include <stdexcept>
 #include <unordered_map>
 #include <regex>
+#include <algorithm>
+#include <sstream>
+#include <optional>
+#include <memory>
+#include <thread>
+#include <atomic>
 
 #include "include/odeSystem.h"
 
@@ -24,156 +30,337 @@ std::string ODESystem::getInpFileName() {
 	return systemName;
 }
 
-std::string ODESystem::parseVar(std::string &inp) {
-	std::regex var_r(R"(^\s*var\s*([^\s]+)\s*=\s*([^;]+)\s*;)");
-	std::smatch s;
-	if (std::regex_search(inp, s, var_r) && s.size() == 3) {
-		std::string ret = s.str(1);
-		inp = s.str(2);
-		return ret;
+/*
+*		var <name> = <expr>;
+*		The right hand side is handed to the expression parser as a whole
+*/
+void ODESystem::parseVar(Lexer& lex, ODE& ode, NodeArena& nodes) {
+	lex.expectKeyword("var");
+	Token name = lex.expect(TokenType::IDENT, "variable name");
+	lex.expect(TokenType::EQUALS, "'='");
+	Token rhs = lex.statementText();
+	lex.expect(TokenType::SEMICOLON, "';'");
+
+	Expr* e = new Expr(&nodes);
+	try {
+		e->parse(rhs.text);
+	} catch (const ParseError &err) {
+		delete e;
+		// the expression reports positions relative to its own text
+		int line = rhs.line + err.line - 1;
+		int col = (err.line == 1) ? rhs.col + err.col - 1 : err.col;
+		throw ParseError("invalid expression for " + std::string(name.text) + ": " + err.what(),
+										 line, col);
 	}
-	throw std::invalid_argument("Failed to parse variable\n");
+	ode.varNames.emplace_back(name.text);
+	ode.varValues.push_back(e);
 } 
 
-std::pair<double, double> ODESystem::parseInterval(std::string &inp) {
-	std::regex interval_r(R"(^\s*interval\s*([^\s]+)\s*=\s*\[\s*([+-]?[0-9]*[.]?[0-9]+)\s*,\s*([+-]?[0-9]*\.?[0-9]+)\s*];)");
-	std::smatch s;
-	if (std::regex_search(inp, s, interval_r) && s.size() == 4) {
-		return std::make_pair(std::stod(s[2]), std::stod(s[3]));
-	}	
-	throw std::invalid_argument("Failed to parse interval");
+/*
+*		interval <name> = [<lower>, <upper>];
+*/
+void ODESystem::parseInterval(Lexer& lex, 
+															std::unordered_map<std::string, std::pair<double, double>>& intervals) {
+	lex.expectKeyword("interval");
+	Token name = lex.expect(TokenType::IDENT, "variable name");
+	lex.expect(TokenType::EQUALS, "'='");
+	lex.expect(TokenType::LBRACKET, "'['");
+	double lower = lex.expect(TokenType::NUMBER, "lower bound").value;
+	lex.expect(TokenType::COMMA, "','");
+	double upper = lex.expect(TokenType::NUMBER, "upper bound").value;
+	lex.expect(TokenType::RBRACKET, "']'");
+	lex.expect(TokenType::SEMICOLON, "';'");
+
+	if (!intervals.emplace(name.text, std::make_pair(lower, upper)).second) {
+		throw ParseError("duplicate interval for " + std::string(name.text), name.line, name.col);
+	}
 }
 
-double ODESystem::parseTime(std::string &inp) {
-	std::regex time_r(R"(^\s*time\s*([0-9]*\.?[0-9]+)\s*;)");
-	std::smatch s;
-	if (std::regex_search(inp, s, time_r) && s.size() == 2) {
-		return std::stod((std::string)s[1]);
+/*
+*		time <float>;
+*/
+double ODESystem::parseTime(Lexer& lex) {
+	lex.expectKeyword("time");
+	double t = lex.expect(TokenType::NUMBER, "time duration").value;
+	lex.expect(TokenType::SEMICOLON, "';'");
+	return t;
+}
+
+/*
+*		emit <name> as <global>;
+*		Emits are kept with their system and merged into global once all systems
+*		have been read
+*/
+void ODESystem::parseEmit(Lexer& lex, ODE& ode) {
+	lex.expectKeyword("emit");
+	Token local = lex.expect(TokenType::IDENT, "variable name");
+	lex.expectKeyword("as");
+	Token name = lex.expect(TokenType::IDENT, "global name");
+	lex.expect(TokenType::SEMICOLON, "';'");
+
+	ode.emits.emplace_back(std::string(local.text), std::string(name.text));
+}
+
+void ODESystem::addGlobals(const ODE& ode) {
+	scalars sc = {0.0, 0.0};
+	for (const auto& e : ode.emits) {
+		auto res = global.insert_or_assign(e.second, std::make_tuple(e.first, 0.0, sc));
+		if (res.second) {
+			globalOrder.push_back(res.first->first);
+		}
 	}
-	throw std::invalid_argument("Failed to parse time");
 }
 
-void ODESystem::parseEmit(std::string &inp) {
-	std::regex emit_r(R"(^\s*emit\s*([^\s]+)\s*as\s*([^\s]+)\s*;)");
-	std::smatch s; 
-	if (std::regex_search(inp, s, emit_r) && s.size() == 3) {
-		scalars sc = {0.0, 0.0};
-		global[s[2]] = std::make_tuple(s[1], 0.0, sc);
+/*
+*		system { {<var>|<interval>|<emit>|<time>} }
+*		Intervals are matched to their variable by name once the block is closed
+*/
+ODE ODESystem::parseSystem(Lexer& lex, NodeArena& nodes) {
+	ODE ode;
+	ode.time = 0.0;
+	std::unordered_map<std::string, std::pair<double, double>> intervals;
+
+	lex.expectKeyword("system");
+	lex.expect(TokenType::LBRACE, "'{'");
+	try {
+		while (lex.peek().type != TokenType::RBRACE) {
+			const Token& t = lex.peek();
+			if (t.type == TokenType::IDENT && t.text == "var") {
+				parseVar(lex, ode, nodes);
+			}
+			else if (t.type == TokenType::IDENT && t.text == "interval") {
+				parseInterval(lex, intervals);
+			}
+			else if (t.type == TokenType::IDENT && t.text == "time") {
+				ode.time = parseTime(lex);
+			}
+			else if (t.type == TokenType::IDENT && t.text == "emit") {
+				parseEmit(lex, ode);
+			}
+			else if (t.type == TokenType::END) {
+				throw ParseError("missing '}' at end of system", t.line, t.col);
+			}
+			else {
+				throw ParseError("unknown statement '" + std::string(t.text) + "'", t.line, t.col);
+			}
+		}
+		Token close = lex.next();
+
+		for (const auto& n : ode.varNames) {
+			auto it = intervals.find(n);
+			if (it == intervals.end()) {
+				throw ParseError("no interval given for " + n, close.line, close.col);
+			}
+			ode.interval.push_back(it->second);
+			intervals.erase(it);
+		}
+		if (!intervals.empty()) {
+			throw ParseError("interval given for unknown variable " + intervals.begin()->first,
+											 close.line, close.col);
+		}
+	} catch (const ParseError &e) {
+		for (auto& v : ode.varValues) {
+			delete v;
+		}
+		throw;
 	}
+	return ode;
 }
 
-void ODESystem::setScalars(ODE o) {
+void ODESystem::setScalars(const ODE& o, std::ostream& out) {
 	for (size_t i = 0; i < o.interval.size(); i += 1) {
 		o.varValues[i]->setScalar(o.interval[i]);
+		out << o.varValues[i]->getRho() << ' ' << o.varValues[i]->getDelta() << '\n';
 	}	
 }	
 
-int ODESystem::readODESystem(std::ifstream& inp, 
+static void printSystem(const ODE& ode, std::ostream& out, std::ostream& log) {
+	for (size_t i = 0; i < ode.varNames.size(); i += 1) {
+		log << ode.varNames[i] << " = ";
+		ode.varValues[i]->print(out); 
+		log << " [" << ode.interval[i].first << ";" << ode.interval[i].second << "]\n";
+	}
+	log << "time = " << ode.time << "\n\n";
+}
+
+/*
+*		A system block of the input together with everything its worker produced,
+*		output is buffered so it can be written in input order
+*/
+struct SystemBlock {
+	std::string_view text;
+	int line;
+	int col;
+
+	ODE ode;
+	NodeArena nodes;
+	bool parsed = false;
+	std::optional<ParseError> error;
+	std::ostringstream out;
+	std::ostringstream log;
+	std::ostringstream clusterOut;
+	std::ostringstream clusterLog;
+};
+
+/*
+*		Split the input after the closing brace of every top level block so the
+*		blocks can be parsed independently, positions are kept for error reports
+*/
+static std::vector<std::unique_ptr<SystemBlock>> splitSystems(std::string_view src) {
+	std::vector<std::unique_ptr<SystemBlock>> blocks;
+	size_t start = 0;
+	int startLine = 1;
+	int startCol = 1;
+	int line = 1;
+	int col = 1;
+	int depth = 0;
+
+	for (size_t i = 0; i < src.size(); i += 1) {
+		char ch = src[i];
+		if (ch == '{') {
+			depth += 1;
+		}
+		else if (ch == '}' && depth > 0 && --depth == 0) {
+			auto b = std::make_unique<SystemBlock>();
+			b->text = src.substr(start, i + 1 - start);
+			b->line = startLine;
+			b->col = startCol;
+			blocks.push_back(std::move(b));
+			start = i + 1;
+			startLine = line;
+			startCol = col + 1;
+		}
+
+		if (ch == '\n') {
+			line += 1;
+			col = 1;
+		}
+		else {
+			col += 1;
+		}
+	}
+
+	// anything after the last block has to be whitespace, which the lexer checks
+	if (start < src.size()) {
+		auto b = std::make_unique<SystemBlock>();
+		b->text = src.substr(start);
+		b->line = startLine;
+		b->col = startCol;
+		blocks.push_back(std::move(b));
+	}
+	return blocks;
+}
+
+int ODESystem::readODESystem(std::string_view src, 
 														const bool scaled, 
 														const bool clustering,
 														const bool d) {
-	std::string line;
-
-	std::regex system_r(R"(^\s*system\s+)");
-	std::regex var_r(R"(^\s*var\s+)");
-	std::regex interval_r(R"(^\s*interval\s+)");
-	std::regex time_r(R"(^\s*time\s+)");
-	std::regex emit_r(R"(^\s*emit\s+)");
-
-	while (std::getline(inp, line)) {
-		if (std::regex_search(line, system_r)) {
-			ODE ode;
-			while(std::getline(inp, line) && line != "}") {
-				if (std::regex_search(line, var_r)) {
-					try {
-						std::string x = parseVar(line);
-						ode.varNames.push_back(x);
-						Expr* e = new Expr();
-						e->parse(line);
-						ode.varValues.push_back(e);
-					} catch (const std::logic_error &e) {
-						std::cerr << "Error parsing var: " << e.what() << '\n';
-						return 1;
-					}
-				}
-				else if (std::regex_search(line, interval_r)) {
-					try {
-						ode.interval.push_back(parseInterval(line));
-					} catch (const std::invalid_argument &e) {
-						std::cerr << "Error parsing interval: " << e.what() << '\n';
-						return 1;
-					}
-				}
-				else if (std::regex_search(line, time_r)) {
-					try {
-						ode.time = parseTime(line);
-					} catch (const std::invalid_argument &e) {
-						std::cerr << "Error parsing time: " << e.what() << '\n';
-						return 1;
-					}
-				}
-				else if (std::regex_search(line, emit_r)) {
-					try {
-						parseEmit(line);
-					} catch(const std::invalid_argument &e) {
-						std::cerr << "Error parsing emit: " << e.what() << '\n';
-					}
-				}
-			}
-			
-			// if -s was given as the command line argument set the scalars
-			if (scaled) {
-				setScalars(ode);
+	std::vector<std::unique_ptr<SystemBlock>> blocks = splitSystems(src);
+
+	// parse, scale and cluster every block on a worker, nothing shared is
+	// written until the blocks are merged below
+	auto process = [&](SystemBlock& b) {
+		try {
+			Lexer lex(b.text, b.line, b.col);
+			if (lex.peek().type == TokenType::END) {
+				return;
 			}
+			b.ode = parseSystem(lex, b.nodes);
+			b.parsed = true;
+		} catch (const ParseError &e) {
+			b.error = e;
+			return;
+		}
+
+		// if -s was given as the command line argument set the scalars
+		if (scaled) {
+			setScalars(b.ode, b.out);
+		}
+		if (d) {
+			printSystem(b.ode, b.out, b.log);
+		}
+		//compare and cluster variable expressions making it so the least changes have to occur between each config
+		if (clustering) {
+			b.ode = cluster(b.ode, b.clusterLog);
 			if (d) {
-				for (size_t i = 0; i < ode.varNames.size(); i += 1) {
-					std::cerr << ode.varNames[i] << " = ";
-					ode.varValues[i]->print(); 
-					std::cerr << " [" << ode.interval[i].first << ";" << ode.interval[i].second << "]\n";
+				b.clusterLog << "Reordered system to: \n";
+				printSystem(b.ode, b.clusterOut, b.clusterLog);
+			}
+		}
+	};
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < blocks.size(); i = next++) {
+			process(*blocks[i]);
+		}
+	};
+	size_t nThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), blocks.size());
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < nThreads; i += 1) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : threads) {
+		t.join();
+	}
+
+	// merge in input order, the first error in the input is the one reported
+	for (auto& b : blocks) {
+		if (b->error) {
+			const ParseError& e = *b->error;
+			std::cerr << "Error parsing " << systemName << ".ode:" << e.line << ":" << e.col << ": " << e.what() << '\n';
+			for (auto& other : blocks) {
+				if (other->parsed) {
+					for (auto& v : other->ode.varValues) {
+						delete v;
+					}
 				}
-				std::cerr << "time = " << ode.time << "\n\n";
 			}
-			ODES.push_back(ode);
+			return 1;
+		}
+	}
+	for (auto& b : blocks) {
+		std::cout << b->out.str();
+		std::cerr << b->log.str();
+		if (b->parsed) {
+			NodeId offset = arena.append(std::move(b->nodes));
+			for (auto& e : b->ode.varValues) {
+				e->relocate(&arena, offset);
+			}
+			addGlobals(b->ode);
+			ODES.push_back(b->ode);
 		}
 	}
+	for (auto& b : blocks) {
+		std::cout << b->clusterOut.str();
+		std::cerr << b->clusterLog.str();
+	}
 
+	// initial value and scalars of every global come from the first system
+	// defining its variable
+	std::unordered_map<std::string, std::pair<size_t, size_t>> firstDef;
+	for (size_t k = 0; k < ODES.size(); k += 1) {
+		for (size_t i = 0; i < ODES[k].varNames.size(); i += 1) {
+			firstDef.emplace(ODES[k].varNames[i], std::make_pair(k, i));
+		}
+	}
   for (auto& it : global) {
     std::string varName = std::get<0>(it.second);
     double initialValue = 0.0;
     double rho = 0.0;
     double delta = 0.0;
 
-    // Find the initial value in the ODES
-    for (const auto& ode : ODES) {
-      auto itVar = std::find(ode.varNames.begin(), ode.varNames.end(), varName);
-      if (itVar != ode.varNames.end()) {
-        size_t index = std::distance(ode.varNames.begin(), itVar);
-        initialValue = ode.varValues[index]->getInit();
-        rho = ode.varValues[index]->getRho();
-        delta = ode.varValues[index]->getDelta();
-        break;
-    	}
-  	}
+    auto def = firstDef.find(varName);
+    if (def != firstDef.end()) {
+      Expr* e = ODES[def->second.first].varValues[def->second.second];
+      initialValue = e->getInit();
+      rho = e->getRho();
+      delta = e->getDelta();
+    }
   	scalars sc = {rho, delta};
     it.second = std::make_tuple(varName, initialValue, sc);
   }
-  //compare and cluster variable expressions making it so the least changes have to occur between each config
-  if (clustering) {
-  	for (auto& ode : ODES) {
-  		ODE tmp = cluster(ode);
-  		ode = tmp;
-
-			if (d) {
-				std::cerr << "Reordered system to: \n";  		
-	  		for (size_t i = 0; i < ode.varValues.size(); i += 1) {
-	  			std::cerr << ode.varNames[i] << " = ";
-	  			ode.varValues[i]->print();
-	  			std::cerr << " [" << ode.interval[i].first << ";" << ode.interval[i].second << "]\n";
-	  		}
-	  		std::cerr << "time = " << ode.time << "\n\n";
-  		}
-  	}
-  }
   if (d) {
   	for (auto& it : global) {
   		std::cerr << std::get<0>(it.second) << " emitted as " << it.first << " with " << std::get<1>(it.second) << '\n';
@@ -182,4 +369,4 @@ int ODESystem::readODESystem(std::ifstream& inp,
   }
 
 	return 0;	
-}
\ No newline at end of file
+}
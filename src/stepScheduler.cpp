@@ -0,0 +1,317 @@
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <functional>
+
+#include "include/stepScheduler.h"
+#include "include/constants.h"
+
+/*
+*		Build the conflicts between the systems from the global slots each of
+*		them reads and writes, emitted is the number of values a system emits
+*		per step
+*/
+StepScheduler::StepScheduler(const std::vector<std::vector<uint32_t>>& reads,
+														 const std::vector<std::vector<uint32_t>>& writes,
+														 const std::vector<size_t>& emitted)
+	: reads(reads), writes(writes), before(reads.size()), after(reads.size()), width(0), conflicts(0),
+		pool(nullptr), steps(0), step(nullptr), row(nullptr), written(0) {
+	auto meets = [](const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+		for (uint32_t x : a) {
+			if (std::find(b.begin(), b.end(), x) != b.end()) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	for (size_t i = 0; i < reads.size(); i += 1) {
+		for (size_t j = 0; j < i; j += 1) {
+			if (meets(writes[j], reads[i]) || meets(reads[j], writes[i]) || meets(writes[j], writes[i])) {
+				before[i].push_back(j);
+				after[j].push_back(i);
+				conflicts += 1;
+			}
+		}
+	}
+	for (size_t i = 0; i < emitted.size(); i += 1) {
+		offset.push_back(width);
+		width += emitted[i];
+	}
+}
+
+/*
+*		Pipeline the systems, views[i] are the values of the globals system i
+*		reads. A global is passed to a system from the last system before it
+*		which writes it in the same step, else from the last one which writes
+*		it in the step before, just as the sequential loop would leave it
+*/
+void StepScheduler::pipeline(const std::vector<double*>& v) {
+	const size_t n = reads.size();
+	views = v;
+	edges.clear();
+	inputs.assign(n, {});
+	outputs.assign(n, {});
+
+	for (size_t i = 0; i < n; i += 1) {
+		for (uint32_t g : reads[i]) {
+			size_t from = n;
+			size_t lag = 0;
+			for (size_t j = 0; j < n; j += 1) {
+				if (std::find(writes[j].begin(), writes[j].end(), g) == writes[j].end()) {
+					continue;
+				}
+				if (j < i) {
+					from = j;
+				}
+				else if (from == n || lag == 1) {
+					from = j;
+					lag = 1;
+				}
+			}
+			//a global nobody writes keeps its value, one only i writes is in its view
+			if (from == n || from == i) {
+				continue;
+			}
+
+			size_t e = 0;
+			while (e < inputs[i].size() && edges[inputs[i][e]].from != from) {
+				e += 1;
+			}
+			if (e == inputs[i].size()) {
+				inputs[i].push_back(edges.size());
+				outputs[from].push_back(edges.size());
+				edges.push_back(Edge{from, i, lag, {}, {}, nullptr});
+			}
+			Edge& edge = edges[inputs[i][e]];
+			edge.slots.push_back(g);
+			//the last emit of g is the one which stays in the globals
+			auto w = std::find(writes[from].rbegin(), writes[from].rend(), g);
+			edge.emits.push_back(writes[from].rend() - w - 1);
+		}
+	}
+}
+
+/*
+*		Whether any two systems can step at the same time
+*/
+bool StepScheduler::isParallel() const {
+	size_t n = before.size();
+	return n > 1 && (!views.empty() || conflicts < n * (n - 1) / 2);
+}
+
+/*
+*		Whether system i can take its next step: the conflicting systems before
+*		it have taken this step, the ones after it the step before, and the row
+*		of the step has a place in the ring. When pipelined, every ring into it
+*		has the globals of the step and every ring out of it has room
+*/
+bool StepScheduler::ready(size_t i) const {
+	size_t s = done[i];
+	if (s >= steps || s >= written + STEPRING) {
+		return false;
+	}
+	if (!views.empty()) {
+		for (size_t e : inputs[i]) {
+			if (s >= edges[e].lag && edges[e].ring->empty()) {
+				return false;
+			}
+		}
+		for (size_t e : outputs[i]) {
+			if (edges[e].ring->full()) {
+				return false;
+			}
+		}
+		return true;
+	}
+	for (size_t j : before[i]) {
+		if (done[j] <= s) {
+			return false;
+		}
+	}
+	for (size_t j : after[i]) {
+		if (done[j] < s) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+*		Queue the next step of system i if it is ready and not queued yet.
+*		Readiness only changes to true while the step is not taken, so a check
+*		after every finished step launches each step exactly once. The step can
+*		be taken by another thread between the first check and taking queued,
+*		so it is checked again while holding it, and when it has to be given up
+*		once more after that, since a launch in between returned on seeing it
+*/
+void StepScheduler::launch(size_t i) {
+	for (;;) {
+		if (queued[i] || !ready(i)) {
+			return;
+		}
+		bool expected = false;
+		if (!queued[i].compare_exchange_strong(expected, true)) {
+			return;
+		}
+		if (ready(i)) {
+			break;
+		}
+		queued[i] = false;
+	}
+	pool->submit([this, i]() {
+		if (pool->hasFailed()) {
+			return;
+		}
+		size_t s = done[i];
+		double* out = rows.data() + (s % STEPRING) * width + offset[i];
+		take(i, s);
+		(*step)(i, s, out);
+		give(i, out);
+		finish(i, s);
+	});
+}
+
+void StepScheduler::finish(size_t i, size_t s) {
+	done[i] = s + 1;
+	bool rowDone = (--remaining[s % STEPRING] == 0);
+	queued[i] = false;
+	if (rowDone) {
+		writeRows();
+	}
+	if (pool->hasFailed()) {
+		return;
+	}
+	launch(i);
+	if (!views.empty()) {
+		for (size_t e : inputs[i]) {
+			launch(edges[e].from);
+		}
+		for (size_t e : outputs[i]) {
+			launch(edges[e].to);
+		}
+		return;
+	}
+	for (size_t j : before[i]) {
+		launch(j);
+	}
+	for (size_t j : after[i]) {
+		launch(j);
+	}
+}
+
+/*
+*		Copy the globals system i reads in step s from the rings into its view
+*/
+void StepScheduler::take(size_t i, size_t s) {
+	if (views.empty()) {
+		return;
+	}
+	for (size_t e : inputs[i]) {
+		Edge& edge = edges[e];
+		if (s < edge.lag) {
+			continue;
+		}
+		const double* values = edge.ring->front();
+		for (size_t k = 0; k < edge.slots.size(); k += 1) {
+			views[i][edge.slots[k]] = values[k];
+		}
+		edge.ring->pop();
+	}
+}
+
+/*
+*		Pass what system i emitted in its step to the systems which read it
+*/
+void StepScheduler::give(size_t i, const double* out) {
+	if (views.empty()) {
+		return;
+	}
+	for (size_t e : outputs[i]) {
+		Edge& edge = edges[e];
+		double* values = edge.ring->back();
+		for (size_t k = 0; k < edge.emits.size(); k += 1) {
+			values[k] = out[edge.emits[k]];
+		}
+		edge.ring->push();
+	}
+}
+
+/*
+*		Hand every complete row to row in order, which frees its place in the
+*		ring for the systems which waited for it
+*/
+void StepScheduler::writeRows() {
+	bool any = false;
+	{
+		std::lock_guard<std::mutex> lock(writeMutex);
+		for (size_t s = written; s < steps && remaining[s % STEPRING] == 0; s = written) {
+			(*row)(s, rows.data() + (s % STEPRING) * width);
+			remaining[s % STEPRING] = before.size();
+			written = s + 1;
+			any = true;
+		}
+	}
+	if (!any) {
+		return;
+	}
+	if (written == steps) {
+		pool->wake();
+		return;
+	}
+	for (size_t i = 0; i < before.size(); i += 1) {
+		launch(i);
+	}
+}
+
+/*
+*		Take steps 0 to steps - 1 of every system, on the pool when there is one
+*		with more than one thread and systems which can step at the same time
+*/
+void StepScheduler::run(ThreadPool* p, size_t n, const Step& st, const Row& r) {
+	const size_t systems = before.size();
+	for (auto& edge : edges) {
+		edge.ring = std::make_unique<SpscRing>(edge.slots.size(), STEPRING);
+	}
+	if (!p || p->size() == 1 || !isParallel()) {
+		std::vector<double> values(width);
+		for (size_t s = 0; s < n; s += 1) {
+			for (size_t i = 0; i < systems; i += 1) {
+				take(i, s);
+				st(i, s, values.data() + offset[i]);
+				give(i, values.data() + offset[i]);
+			}
+			r(s, values.data());
+		}
+		return;
+	}
+
+	pool = p;
+	steps = n;
+	step = &st;
+	row = &r;
+	done = std::make_unique<std::atomic<size_t>[]>(systems);
+	queued = std::make_unique<std::atomic<bool>[]>(systems);
+	remaining = std::make_unique<std::atomic<size_t>[]>(STEPRING);
+	for (size_t i = 0; i < systems; i += 1) {
+		done[i] = 0;
+		queued[i] = false;
+	}
+	for (size_t k = 0; k < STEPRING; k += 1) {
+		remaining[k] = systems;
+	}
+	rows.assign(STEPRING * width, 0.0);
+	written = 0;
+
+	if (systems == 0 || steps == 0) {
+		return;
+	}
+	for (size_t i = 0; i < systems; i += 1) {
+		launch(i);
+	}
+	pool->runUntil([this]() {
+		return written == steps;
+	});
+}
@@ -0,0 +1,234 @@
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "include/streamSink.h"
+#include "include/constants.h"
+
+static const char MAGIC[8] = {'O', 'D', 'E', 'S', 'T', 'R', 'M', '1'};
+
+bool StreamSink::open(const std::string& target, const std::vector<std::string>& names) {
+	close();
+	this->target = target;
+	socket = false;
+	lost = false;
+	made = false;
+	if (target != "-") {
+		struct stat st;
+		if (stat(target.c_str(), &st) != 0) {
+			if (mkfifo(target.c_str(), 0644) != 0) {
+				return false;
+			}
+			made = true;
+		}
+		else if (S_ISSOCK(st.st_mode)) {
+			socket = true;
+		}
+		else if (!S_ISFIFO(st.st_mode)) {
+			return false;
+		}
+	}
+
+	columns = names.size();
+	StreamHeader header;
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.columns = columns;
+	header.frameSize = (2 + columns) * sizeof(double);
+	head.assign(reinterpret_cast<const char*>(&header), reinterpret_cast<const char*>(&header) + sizeof(header));
+	for (const auto& name : names) {
+		uint32_t length = name.size();
+		head.insert(head.end(), reinterpret_cast<const char*>(&length), reinterpret_cast<const char*>(&length) + sizeof(length));
+		head.insert(head.end(), name.begin(), name.end());
+	}
+
+	//a viewer going away must not end the simulation
+	std::signal(SIGPIPE, SIG_IGN);
+	ring = std::make_unique<SpscRing>(2 + columns, STREAMRING);
+	sequence = 0;
+	sent = 0;
+	dropped = 0;
+	discarded = 0;
+	stop.store(false, std::memory_order_relaxed);
+	writer = std::thread(&StreamSink::run, this);
+	return true;
+}
+
+/*
+*		The frame is built in the ring, the sequence number in the place of the
+*		first double
+*/
+void StreamSink::row(double time, const double* values) {
+	if (!ring) {
+		return;
+	}
+	if (ring->full()) {
+		dropped += 1;
+		sequence += 1;
+		return;
+	}
+	double* frame = ring->back();
+	std::memcpy(frame, &sequence, sizeof(sequence));
+	frame[1] = time;
+	std::copy(values, values + columns, frame + 2);
+	ring->push();
+	sequence += 1;
+}
+
+/*
+*		Stop the thread once it wrote out the ring and the last frame, a FIFO
+*		made by open is removed again
+*/
+void StreamSink::close() {
+	if (!writer.joinable()) {
+		return;
+	}
+	stop.store(true, std::memory_order_release);
+	writer.join();
+	detach();
+	ring.reset();
+	if (made) {
+		unlink(target.c_str());
+		made = false;
+	}
+}
+
+/*
+*		Open the FIFO or connect to the socket without blocking, a FIFO without
+*		a reader or a socket nobody listens on fails until a viewer comes
+*/
+bool StreamSink::attach() {
+	if (target == "-") {
+		if (lost) {
+			return false;
+		}
+		fd = STDOUT_FILENO;
+	}
+	else if (socket) {
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		if (target.size() >= sizeof(addr.sun_path)) {
+			return false;
+		}
+		std::memcpy(addr.sun_path, target.c_str(), target.size());
+		fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) {
+			return false;
+		}
+		if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+			detach();
+			return false;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+	else {
+		fd = ::open(target.c_str(), O_WRONLY | O_NONBLOCK);
+		if (fd < 0) {
+			return false;
+		}
+	}
+	if (!send(head.data(), head.size())) {
+		detach();
+		return false;
+	}
+	return true;
+}
+
+void StreamSink::detach() {
+	if (fd == STDOUT_FILENO) {
+		lost = true;
+	}
+	else if (fd >= 0) {
+		::close(fd);
+	}
+	fd = -1;
+}
+
+/*
+*		Write all of it, waiting for a viewer which is slow to read. Once the
+*		simulation is over a viewer which stopped reading is given up on
+*/
+bool StreamSink::send(const void* p, size_t n) {
+	const char* c = static_cast<const char*>(p);
+	while (n > 0) {
+		ssize_t w = ::write(fd, c, n);
+		if (w > 0) {
+			c += w;
+			n -= w;
+			continue;
+		}
+		if (w < 0 && errno == EINTR) {
+			continue;
+		}
+		if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			pollfd out{fd, POLLOUT, 0};
+			if (poll(&out, 1, STREAMWAIT) == 0 && stop.load(std::memory_order_acquire)) {
+				return false;
+			}
+			continue;
+		}
+		return false;
+	}
+	return true;
+}
+
+void StreamSink::run() {
+	const size_t frameSize = (2 + columns) * sizeof(double);
+	std::vector<char> batch;
+	for (;;) {
+		//everything pushed before the stop is in the ring once it is seen
+		const bool last = stop.load(std::memory_order_acquire);
+		if (fd < 0 && !attach()) {
+			//nobody watches, the frames so far are of no use to the next viewer
+			while (!ring->empty()) {
+				ring->pop();
+				discarded += 1;
+			}
+			if (last) {
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(STREAMWAIT));
+			continue;
+		}
+		//the frames ready so far go out in one write
+		while (fd >= 0 && !ring->empty()) {
+			batch.clear();
+			size_t count = 0;
+			for (; count < STREAMRING && !ring->empty(); count += 1) {
+				const char* frame = reinterpret_cast<const char*>(ring->front());
+				batch.insert(batch.end(), frame, frame + frameSize);
+				ring->pop();
+			}
+			if (send(batch.data(), batch.size())) {
+				sent += count;
+			}
+			else {
+				detach();
+				discarded += count;
+			}
+		}
+		if (last) {
+			if (fd >= 0) {
+				std::vector<double> end(2 + columns, 0.0);
+				const uint64_t none = ~uint64_t(0);
+				std::memcpy(end.data(), &none, sizeof(none));
+				send(end.data(), frameSize);
+			}
+			return;
+		}
+		if (ring->empty()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
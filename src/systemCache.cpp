@@ -0,0 +1,233 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "include/odeSystem.h"
+#include "include/mappedFile.h"
+#include "include/cacheIO.h"
+
+constexpr uint32_t CACHEMAGIC = 0x4345444f;		// "ODEC"
+constexpr uint32_t CACHEVERSION = 5;
+
+/*
+*		64-bit hash of the input, mixing eight bytes at a time so hashing large
+*		generated files costs little compared to parsing them
+*/
+uint64_t ODESystem::hashContent(std::string_view src) {
+	const uint64_t m = 0xff51afd7ed558ccdULL;
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ (src.size() * m);
+
+	size_t i = 0;
+	for (; i + 8 <= src.size(); i += 8) {
+		uint64_t w;
+		std::memcpy(&w, src.data() + i, 8);
+		h = (h ^ w) * m;
+		h ^= h >> 32;
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, src.data() + i, src.size() - i);
+	h = (h ^ tail) * m;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+*		Write the parsed, scaled and clustered systems to the cache file, the file
+*		is written next to the final one and renamed so readers never see a
+*		partial cache
+*/
+bool ODESystem::writeCache(const std::string& path, uint64_t hash, uint8_t flags) const {
+	std::string tmp = path + ".tmp";
+	std::ofstream of(tmp, std::ios::binary);
+	if (!of.is_open()) {
+		return false;
+	}
+	CacheWriter w(of);
+
+	w.put(CACHEMAGIC);
+	w.put(CACHEVERSION);
+	w.put(hash);
+	w.put(flags);
+
+	w.put<uint32_t>(arena.size());
+	w.putBytes(arena.data(), arena.size() * sizeof(Node));
+	w.put<uint32_t>(arena.nameCount());
+	for (size_t i = 0; i < arena.nameCount(); i += 1) {
+		w.putString(arena.nameOf(i));
+	}
+
+	w.put<uint32_t>(ODES.size());
+	for (const auto& ode : ODES) {
+		w.put<uint32_t>(ode.varNames.size());
+		for (size_t i = 0; i < ode.varNames.size(); i += 1) {
+			w.putString(ode.varNames[i]);
+			w.put(ode.interval[i].first);
+			w.put(ode.interval[i].second);
+			ode.varValues[i]->serialize(w);
+		}
+		w.put(ode.time);
+		w.put<uint32_t>(ode.emits.size());
+		for (const auto& e : ode.emits) {
+			w.putString(e.first);
+			w.putString(e.second);
+		}
+	}
+
+	w.put<uint32_t>(globalOrder.size());
+	for (const auto& name : globalOrder) {
+		const auto& g = global.at(name);
+		w.putString(name);
+		w.putString(std::get<0>(g));
+		w.put(std::get<1>(g));
+		w.put(std::get<2>(g).rho);
+		w.put(std::get<2>(g).delta);
+	}
+	of.close();
+
+	if (!of || std::rename(tmp.c_str(), path.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+/*
+*		The nodes of a cache file are used as indices without further checks, a
+*		node may only refer to nodes before it and to names which were read. As
+*		the operands are added to the arena before their operator this also
+*		keeps a damaged file from making a cycle
+*/
+static void checkNodes(const NodeArena& nodes) {
+	auto child = [](NodeId c, NodeId i) {
+		if (c >= i) {
+			throw std::out_of_range("Invalid node in cache file\n");
+		}
+	};
+	for (NodeId i = 0; i < nodes.size(); i += 1) {
+		const Node& n = nodes[i];
+		switch (n.op) {
+		case NodeType::NUM:
+			break;
+		case NodeType::VAR:
+			if (n.name >= nodes.nameCount()) {
+				throw std::out_of_range("Invalid name in cache file\n");
+			}
+			break;
+		case NodeType::WAVE:
+			if (n.oper != 's' && n.oper != 'c') {
+				throw std::out_of_range("Invalid node in cache file\n");
+			}
+			child(n.right, i);
+			break;
+		case NodeType::INTEG:
+			child(n.right, i);
+			break;
+		case NodeType::OP:
+			if (n.oper != '+' && n.oper != '-' && n.oper != '*' && n.oper != '/') {
+				throw std::out_of_range("Invalid node in cache file\n");
+			}
+			child(n.left, i);
+			child(n.right, i);
+			break;
+		default:
+			throw std::out_of_range("Invalid node in cache file\n");
+		}
+	}
+}
+
+/*
+*		Load the systems from the cache file, returns false if there is no usable
+*		cache for this input and flag set
+*/
+bool ODESystem::readCache(const std::string& path, uint64_t hash, uint8_t flags) {
+	MappedFile file;
+	if (!file.open(path)) {
+		return false;
+	}
+
+	std::vector<ODE> odes;
+	NodeArena nodes;
+	try {
+		CacheReader r(file.view());
+		if (r.get<uint32_t>() != CACHEMAGIC || r.get<uint32_t>() != CACHEVERSION ||
+				r.get<uint64_t>() != hash || r.get<uint8_t>() != flags) {
+			return false;
+		}
+
+		uint32_t nNodes = r.get<uint32_t>();
+		std::vector<Node> raw(nNodes, Node(NodeType::NUM, 0));
+		r.getBytes(raw.data(), nNodes * sizeof(Node));
+		nodes.assign(raw.data(), nNodes);
+		uint32_t nNames = r.get<uint32_t>();
+		for (uint32_t i = 0; i < nNames; i += 1) {
+			nodes.intern(r.getString());
+		}
+		checkNodes(nodes);
+
+		uint32_t nOdes = r.get<uint32_t>();
+		for (uint32_t k = 0; k < nOdes; k += 1) {
+			odes.emplace_back();
+			ODE& ode = odes.back();
+			uint32_t nVars = r.get<uint32_t>();
+			for (uint32_t i = 0; i < nVars; i += 1) {
+				ode.varNames.push_back(r.getString());
+				double lower = r.get<double>();
+				double upper = r.get<double>();
+				ode.interval.push_back(std::make_pair(lower, upper));
+				ode.varValues.push_back(new Expr(&nodes));
+				ode.varValues.back()->deserialize(r);
+			}
+			ode.time = r.get<double>();
+			uint32_t nEmits = r.get<uint32_t>();
+			for (uint32_t i = 0; i < nEmits; i += 1) {
+				std::string local = r.getString();
+				ode.emits.emplace_back(local, r.getString());
+			}
+		}
+
+		std::vector<std::string> order;
+		std::unordered_map<std::string, std::tuple<std::string, double, scalars>> globals;
+		uint32_t nGlobals = r.get<uint32_t>();
+		for (uint32_t i = 0; i < nGlobals; i += 1) {
+			std::string name = r.getString();
+			std::string local = r.getString();
+			double value = r.get<double>();
+			scalars sc;
+			sc.rho = r.get<double>();
+			sc.delta = r.get<double>();
+			globals[name] = std::make_tuple(local, value, sc);
+			order.push_back(name);
+		}
+		if (!r.atEnd()) {
+			throw std::out_of_range("Trailing data in cache file\n");
+		}
+
+		arena = std::move(nodes);
+		for (auto& ode : odes) {
+			for (auto& v : ode.varValues) {
+				v->relocate(&arena, 0);
+			}
+		}
+		ODES = std::move(odes);
+		global = std::move(globals);
+		globalOrder = std::move(order);
+	} catch (const std::out_of_range &e) {
+		for (auto& ode : odes) {
+			for (auto& v : ode.varValues) {
+				delete v;
+			}
+		}
+		return false;
+	}
+	return true;
+}
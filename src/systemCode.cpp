@@ -0,0 +1,1025 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <ostream>
+#include <stdexcept>
+
+#include "include/systemCode.h"
+#include "include/threadPool.h"
+#include "include/constants.h"
+
+size_t SystemCode::KeyHash::operator()(const Key& k) const {
+	uint64_t h = static_cast<uint64_t>(k.op);
+	h = h * 0x9e3779b97f4a7c15ULL + k.a;
+	h = h * 0x9e3779b97f4a7c15ULL + k.b;
+	h = h * 0x9e3779b97f4a7c15ULL + k.bits;
+	return h ^ (h >> 29);
+}
+
+uint32_t SystemCode::literal(double v) {
+	uint64_t bits;
+	std::memcpy(&bits, &v, sizeof(bits));
+	Key k{OpCode::PUSH, 0, 0, bits};
+	auto it = table.find(k);
+	if (it != table.end()) {
+		return it->second;
+	}
+	uint32_t r = regs.size();
+	regs.push_back(v);
+	isLiteral.push_back(1);
+	table.emplace(k, r);
+	return r;
+}
+
+uint32_t SystemCode::instr(OpCode op, uint32_t a, uint32_t b, double x, double y) {
+	Key k{op, a, b, 0};
+	auto it = table.find(k);
+	if (it != table.end()) {
+		return it->second;
+	}
+	uint32_t r = regs.size();
+	regs.push_back(0.0);
+	isLiteral.push_back(0);
+	code.push_back(DagInstr{op, r, a, b, x, y});
+	table.emplace(k, r);
+	return r;
+}
+
+static double fold(OpCode op, double a, double b) {
+	switch (op) {
+	case OpCode::ADD:
+		return a + b;
+	case OpCode::SUB:
+		return a - b;
+	case OpCode::MUL:
+		return a * b;
+	default:
+		return a / b;
+	}
+}
+
+/*
+*		Add the subtree at id to the DAG and return its register. Literals and
+*		constants are scaled and folded as in Expr::emitCode, so each register
+*		holds exactly the value the tree would compute for that subterm
+*/
+uint32_t SystemCode::node(const NodeArena& nodes, NodeId id, bool scaled, double rho, double delta,
+													const std::vector<var>& constants,
+													const std::vector<var>& vars,
+													const std::vector<global_var>& global) {
+	if (id == NONODE) {
+		return literal(0.0);
+	}
+	treeNodes += 1;
+
+	const Node n = nodes[id];
+	if (n.op == NodeType::NUM) {
+		return literal(scaled ? ((n.value / rho) + delta) : n.value);
+	}
+	if (n.op == NodeType::VAR) {
+		switch (n.kind) {
+		case SlotKind::CONSTANT: {
+			const var& c = constants[n.slot];
+			if (!foldConstants) {
+				if (scaled) {
+					return instr(OpCode::LOADC_S, n.slot, 0, c.rho, c.delta);
+				}
+				return instr(OpCode::LOADC, n.slot, 0);
+			}
+			return literal(scaled ? ((c.value / c.rho) + c.delta) : c.value);
+		}
+		case SlotKind::LOCAL:
+			if (scaled) {
+				return instr(OpCode::LOADL_S, n.slot, 0, vars[n.slot].rho, vars[n.slot].delta);
+			}
+			return instr(OpCode::LOADL, n.slot, 0);
+		case SlotKind::GLOBAL:
+			if (scaled) {
+				return instr(OpCode::LOADG_S, n.slot, 0, global[n.slot].rho, global[n.slot].delta);
+			}
+			return instr(OpCode::LOADG, n.slot, 0);
+		default:
+			return instr(OpCode::FAIL, VARNOTFOUND, 0);
+		}
+	}
+	if (n.op == NodeType::WAVE && (n.oper == 's' || n.oper == 'c')) {
+		uint32_t r = node(nodes, n.right, scaled, rho, delta, constants, vars, global);
+		if (isLiteral[r]) {
+			return literal((n.oper == 's') ? std::sin(regs[r]) : std::cos(regs[r]));
+		}
+		return instr(n.oper == 's' ? OpCode::SIN : OpCode::COS, r, 0);
+	}
+
+	uint32_t l = node(nodes, n.left, scaled, rho, delta, constants, vars, global);
+	uint32_t r = node(nodes, n.right, scaled, rho, delta, constants, vars, global);
+
+	OpCode op;
+	switch (n.oper) {
+	case '+':
+		op = OpCode::ADD;
+		break;
+	case '-':
+		op = OpCode::SUB;
+		break;
+	case '*':
+		op = OpCode::MUL;
+		break;
+	case '/':
+		op = OpCode::DIV;
+		break;
+	default:
+		return instr(OpCode::FAIL, OPNOTFOUND, 0);
+	}
+
+	if (isLiteral[l] && isLiteral[r] && (op != OpCode::DIV || regs[r] != 0.0)) {
+		return literal(fold(op, regs[l], regs[r]));
+	}
+	if (isLiteral[r]) {
+		double b = regs[r];
+		if (((op == OpCode::MUL || op == OpCode::DIV) && b == 1.0) || (op == OpCode::SUB && b == 0.0 && !std::signbit(b))) {
+			return l;
+		}
+	}
+	if (isLiteral[l] && op == OpCode::MUL && regs[l] == 1.0) {
+		return r;
+	}
+	return instr(op, l, r);
+}
+
+/*
+*		Build the DAG of the expressions, which have to be bound with resolve
+*		against the same arrays first. Without fold the constants are loaded
+*		from the context, so they can differ between the members of an ensemble
+*/
+void SystemCode::build(const std::vector<Expr*>& exprs,
+											 const std::vector<var>& constants,
+											 const std::vector<var>& vars,
+											 const std::vector<global_var>& global,
+											 const bool fold) {
+	foldConstants = fold;
+	batchLanes = 0;
+	jacRows.clear();
+	jacCols.clear();
+	jacRegs.clear();
+	code.clear();
+	regs.clear();
+	isLiteral.clear();
+	table.clear();
+	outputs.clear();
+	outRho.clear();
+	outDelta.clear();
+	linear = false;
+	chunks.clear();
+	treeNodes = 0;
+
+	for (auto& e : exprs) {
+		const NodeArena& nodes = *e->getArena();
+		NodeId start = e->getRoot();
+		if (start != NONODE && nodes[start].op == NodeType::INTEG) {
+			start = nodes[start].right;
+		}
+		outputs.push_back(node(nodes, start, e->getRho() != 0.0, e->getRho(), e->getDelta(),
+													 constants, vars, global));
+		outRho.push_back(e->getRho());
+		outDelta.push_back(e->getDelta());
+	}
+	rhsEnd = code.size();
+	table.clear();
+}
+
+/*
+*		The slots of the globals the right hand side reads
+*/
+std::vector<uint32_t> SystemCode::globalsRead() const {
+	std::vector<uint32_t> slots;
+	for (size_t i = 0; i < rhsEnd; i += 1) {
+		if (code[i].op == OpCode::LOADG || code[i].op == OpCode::LOADG_S) {
+			slots.push_back(code[i].a);
+		}
+	}
+	std::sort(slots.begin(), slots.end());
+	slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+	return slots;
+}
+
+/*
+*		Run count instructions of code on the registers r
+*/
+static void execCode(const DagInstr* code, size_t count, double* r,
+										 const double* constants, const double* locals, const double* globals) {
+	for (size_t i = 0; i < count; i += 1) {
+		const DagInstr& in = code[i];
+		switch (in.op) {
+		case OpCode::LOADC:
+			r[in.dst] = constants[in.a];
+			break;
+		case OpCode::LOADL:
+			r[in.dst] = locals[in.a];
+			break;
+		case OpCode::LOADG:
+			r[in.dst] = globals[in.a];
+			break;
+		case OpCode::LOADC_S:
+			r[in.dst] = (constants[in.a] / in.x) + in.y;
+			break;
+		case OpCode::LOADL_S:
+			r[in.dst] = (locals[in.a] / in.x) + in.y;
+			break;
+		case OpCode::LOADG_S:
+			r[in.dst] = (globals[in.a] / in.x) + in.y;
+			break;
+		case OpCode::ADD:
+			r[in.dst] = r[in.a] + r[in.b];
+			break;
+		case OpCode::SUB:
+			r[in.dst] = r[in.a] - r[in.b];
+			break;
+		case OpCode::MUL:
+			r[in.dst] = r[in.a] * r[in.b];
+			break;
+		case OpCode::DIV:
+			if (r[in.b] == 0.0) {
+				throw std::invalid_argument("Division by 0 not possible\n");
+			}
+			r[in.dst] = r[in.a] / r[in.b];
+			break;
+		case OpCode::SIN:
+			r[in.dst] = std::sin(r[in.a]);
+			break;
+		case OpCode::COS:
+			r[in.dst] = std::cos(r[in.a]);
+			break;
+		case OpCode::FAIL:
+			if (in.a == VARNOTFOUND) {
+				throw std::invalid_argument("Variable not found\n");
+			}
+			throw std::invalid_argument("Operation not found\n");
+		default:
+			break;
+		}
+	}
+}
+
+/*
+*		Run the instructions up to end
+*/
+void SystemCode::exec(size_t end, const EvalContext& ctx) {
+	execCode(code.data(), end, regs.data(),
+					 ctx.constants.value.data(), ctx.locals.value.data(), ctx.globals->value.data());
+}
+
+void SystemCode::outputsTo(std::vector<double>& dxdt) const {
+	for (size_t i = 0; i < outputs.size(); i += 1) {
+		if (outRho[i] != 0.0) {
+			dxdt[i] = (regs[outputs[i]] - outDelta[i]) / outRho[i];
+		}
+		else {
+			dxdt[i] = regs[outputs[i]];
+		}
+	}
+}
+
+void SystemCode::runChunk(Chunk& c, const EvalContext& ctx, std::vector<double>& dxdt) const {
+	execCode(c.code.data(), c.code.size(), c.regs.data(),
+					 ctx.constants.value.data(), ctx.locals.value.data(), ctx.globals->value.data());
+	for (size_t i = c.first; i < c.last; i += 1) {
+		double v = c.regs[c.outputs[i - c.first]];
+		dxdt[i] = (outRho[i] != 0.0) ? (v - outDelta[i]) / outRho[i] : v;
+	}
+}
+
+/*
+*		y = A x + b for A in compressed rows
+*/
+static void spmv(const uint32_t* rows, const uint32_t* cols, const double* vals, size_t n,
+								 const double* __restrict x, const double* __restrict b, double* __restrict y) {
+	for (size_t i = 0; i < n; i += 1) {
+		double s = b[i];
+		for (uint32_t k = rows[i]; k < rows[i + 1]; k += 1) {
+			s += vals[k] * x[cols[k]];
+		}
+		y[i] = s;
+	}
+}
+
+/*
+*		Evaluate every expression of the system, dxdt has to hold one entry per
+*		expression. An affine system is evaluated as A x + b, a partitioned one
+*		runs its chunks on the pool. A x + b sums in another order than the DAG
+*		and with A already divided by the scalars, so near the end of the range
+*		of a double it can overflow where the DAG does not, a result which is not
+*		finite is evaluated again by the DAG
+*/
+void SystemCode::run(const EvalContext& ctx, std::vector<double>& dxdt) {
+	if (linear) {
+		const std::vector<double>& b = offset(ctx);
+		spmv(linRows.data(), linCols.data(), linVals.data(), outputs.size(),
+				 ctx.locals.value.data(), b.data(), dxdt.data());
+		bool finite = true;
+		for (size_t i = 0; i < outputs.size(); i += 1) {
+			finite &= std::isfinite(dxdt[i]);
+		}
+		if (finite) {
+			return;
+		}
+	}
+	if (pool && !chunks.empty()) {
+		pool->parallelFor(chunks.size(), [&](size_t k) {
+			runChunk(chunks[k], ctx, dxdt);
+		});
+		return;
+	}
+	exec(rhsEnd, ctx);
+	outputsTo(dxdt);
+}
+
+/*
+*		The registers instruction in reads
+*/
+static size_t operands(const DagInstr& in, uint32_t* ops) {
+	switch (in.op) {
+	case OpCode::ADD:
+	case OpCode::SUB:
+	case OpCode::MUL:
+	case OpCode::DIV:
+		ops[0] = in.a;
+		ops[1] = in.b;
+		return 2;
+	case OpCode::SIN:
+	case OpCode::COS:
+		ops[0] = in.a;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+*		Split the right hand side into chunks of consecutive expressions which
+*		need about RHSCHUNK instructions each. A chunk gets a copy of those
+*		instructions on registers numbered densely, so it stays in the cache of
+*		the thread running it, a subterm several chunks share is computed by
+*		each of them. A system too small for two chunks is not split, returns
+*		the number of chunks
+*/
+size_t SystemCode::partition() {
+	chunks.clear();
+	if (rhsEnd < 2 * RHSCHUNK) {
+		return 1;
+	}
+
+	const uint32_t NODEF = UINT32_MAX;
+	std::vector<uint32_t> def(regs.size(), NODEF);
+	for (size_t i = 0; i < rhsEnd; i += 1) {
+		def[code[i].dst] = i;
+	}
+	//the chunk which last needed a register, plus one
+	std::vector<size_t> mark(regs.size(), 0);
+	std::vector<uint32_t> local(regs.size());
+	std::vector<uint32_t> stack;
+	uint32_t ops[2];
+	size_t first = 0;
+	size_t count = 0;
+
+	for (size_t o = 0; o < outputs.size(); o += 1) {
+		const size_t stamp = chunks.size() + 1;
+		stack.push_back(outputs[o]);
+		while (!stack.empty()) {
+			uint32_t r = stack.back();
+			stack.pop_back();
+			if (mark[r] == stamp) {
+				continue;
+			}
+			mark[r] = stamp;
+			if (def[r] != NODEF) {
+				count += 1;
+				for (size_t k = operands(code[def[r]], ops); k > 0; k -= 1) {
+					stack.push_back(ops[k - 1]);
+				}
+			}
+		}
+		if (count < RHSCHUNK && o + 1 < outputs.size()) {
+			continue;
+		}
+
+		Chunk c;
+		c.first = first;
+		c.last = o + 1;
+		//the literals come first, they keep their value between runs
+		for (size_t r = 0; r < regs.size(); r += 1) {
+			if (mark[r] == stamp && def[r] == NODEF) {
+				local[r] = c.regs.size();
+				c.regs.push_back(regs[r]);
+			}
+		}
+		for (size_t i = 0; i < rhsEnd; i += 1) {
+			if (mark[code[i].dst] != stamp) {
+				continue;
+			}
+			DagInstr in = code[i];
+			size_t n = operands(in, ops);
+			in.a = n > 0 ? local[in.a] : in.a;
+			in.b = n > 1 ? local[in.b] : in.b;
+			in.dst = local[code[i].dst] = c.regs.size();
+			c.regs.push_back(0.0);
+			c.code.push_back(in);
+		}
+		for (size_t k = first; k <= o; k += 1) {
+			c.outputs.push_back(local[outputs[k]]);
+		}
+		chunks.push_back(std::move(c));
+		first = o + 1;
+		count = 0;
+	}
+
+	if (chunks.size() < 2) {
+		chunks.clear();
+		return 1;
+	}
+	return chunks.size();
+}
+
+size_t SystemCode::getChunkInstrCount() const {
+	size_t n = 0;
+	for (const auto& c : chunks) {
+		n += c.code.size();
+	}
+	return n;
+}
+
+/*
+*		Add op on the derivative registers a and b, with the rules of symbolic
+*		differentiation: a zero derivative is dropped from sums and products and
+*		a factor of one from products
+*/
+uint32_t SystemCode::derive(OpCode op, uint32_t a, uint32_t b) {
+	bool la = isLiteral[a];
+	bool lb = isLiteral[b];
+	if (la && lb && (op != OpCode::DIV || regs[b] != 0.0)) {
+		return literal(fold(op, regs[a], regs[b]));
+	}
+	switch (op) {
+	case OpCode::ADD:
+		if (la && regs[a] == 0.0) {
+			return b;
+		}
+		if (lb && regs[b] == 0.0) {
+			return a;
+		}
+		break;
+	case OpCode::SUB:
+		if (lb && regs[b] == 0.0) {
+			return a;
+		}
+		break;
+	case OpCode::MUL:
+		if ((la && regs[a] == 0.0) || (lb && regs[b] == 0.0)) {
+			return literal(0.0);
+		}
+		if (la && regs[a] == 1.0) {
+			return b;
+		}
+		if (lb && regs[b] == 1.0) {
+			return a;
+		}
+		break;
+	default:
+		if (la && regs[a] == 0.0) {
+			return literal(0.0);
+		}
+		if (lb && regs[b] == 1.0) {
+			return a;
+		}
+		break;
+	}
+	return instr(op, a, b);
+}
+
+/*
+*		Differentiate the DAG with respect to the local vars, the vars the
+*		expressions integrate, and append the code of every structurally non zero
+*		entry of the Jacobian. The derivative of a register is built from the
+*		derivatives of its operands in the order of the code, so subterms the
+*		expressions share are differentiated once. Globals and constants are
+*		constant for the Jacobian of a system
+*/
+void SystemCode::buildJacobian() {
+	if (!jacRows.empty()) {
+		return;
+	}
+	table.clear();
+	for (size_t i = 0; i < regs.size(); i += 1) {
+		if (isLiteral[i]) {
+			uint64_t bits;
+			std::memcpy(&bits, &regs[i], sizeof(bits));
+			table.emplace(Key{OpCode::PUSH, 0, 0, bits}, i);
+		}
+	}
+	for (const DagInstr& in : code) {
+		table.emplace(Key{in.op, in.a, in.b, 0}, in.dst);
+	}
+
+	//(var, register of the derivative) for every register, sorted by var
+	typedef std::vector<std::pair<uint32_t, uint32_t>> Deriv;
+	std::vector<Deriv> deriv(regs.size());
+	auto combine = [&](const Deriv& da, const Deriv& db, auto f) {
+		Deriv d;
+		size_t i = 0;
+		size_t j = 0;
+		while (i < da.size() || j < db.size()) {
+			if (j == db.size() || (i < da.size() && da[i].first < db[j].first)) {
+				d.emplace_back(da[i].first, f(da[i].second, literal(0.0)));
+				i += 1;
+			}
+			else if (i == da.size() || db[j].first < da[i].first) {
+				d.emplace_back(db[j].first, f(literal(0.0), db[j].second));
+				j += 1;
+			}
+			else {
+				d.emplace_back(da[i].first, f(da[i].second, db[j].second));
+				i += 1;
+				j += 1;
+			}
+		}
+		return d;
+	};
+
+	for (size_t i = 0; i < rhsEnd; i += 1) {
+		const DagInstr in = code[i];
+		Deriv d;
+		switch (in.op) {
+		case OpCode::LOADL:
+			d.emplace_back(in.a, literal(1.0));
+			break;
+		case OpCode::LOADL_S:
+			d.emplace_back(in.a, literal(1.0 / in.x));
+			break;
+		case OpCode::ADD:
+			d = combine(deriv[in.a], deriv[in.b], [&](uint32_t x, uint32_t y) {
+				return derive(OpCode::ADD, x, y);
+			});
+			break;
+		case OpCode::SUB:
+			d = combine(deriv[in.a], deriv[in.b], [&](uint32_t x, uint32_t y) {
+				return derive(OpCode::SUB, x, y);
+			});
+			break;
+		case OpCode::MUL:
+			//a' * b + a * b'
+			d = combine(deriv[in.a], deriv[in.b], [&](uint32_t x, uint32_t y) {
+				return derive(OpCode::ADD, derive(OpCode::MUL, x, in.b), derive(OpCode::MUL, in.a, y));
+			});
+			break;
+		case OpCode::DIV:
+			//(a' - (a / b) * b') / b
+			d = combine(deriv[in.a], deriv[in.b], [&](uint32_t x, uint32_t y) {
+				return derive(OpCode::DIV, derive(OpCode::SUB, x, derive(OpCode::MUL, in.dst, y)), in.b);
+			});
+			break;
+		case OpCode::SIN:
+			for (const auto& da : deriv[in.a]) {
+				d.emplace_back(da.first, derive(OpCode::MUL, instr(OpCode::COS, in.a, 0), da.second));
+			}
+			break;
+		case OpCode::COS:
+			for (const auto& da : deriv[in.a]) {
+				d.emplace_back(da.first, derive(OpCode::SUB, literal(0.0),
+																				derive(OpCode::MUL, instr(OpCode::SIN, in.a, 0), da.second)));
+			}
+			break;
+		default:
+			break;
+		}
+		//terms which cancelled to a literal zero are not part of the pattern
+		Deriv nz;
+		for (const auto& e : d) {
+			if (!isLiteral[e.second] || regs[e.second] != 0.0) {
+				nz.push_back(e);
+			}
+		}
+		deriv[in.dst] = std::move(nz);
+	}
+
+	jacRows.push_back(0);
+	for (size_t i = 0; i < outputs.size(); i += 1) {
+		if (outputs[i] < deriv.size()) {
+			for (const auto& e : deriv[outputs[i]]) {
+				jacCols.push_back(e.first);
+				jacRegs.push_back(e.second);
+			}
+		}
+		jacRows.push_back(jacCols.size());
+	}
+	table.clear();
+	batchLanes = 0;
+}
+
+/*
+*		The right hand side is affine in the integrated vars when every entry of
+*		its Jacobian folded to a literal. The columns of the local vars which are
+*		not integrated stay constant, they are part of b
+*/
+bool SystemCode::buildLinear() {
+	linear = false;
+	linRows.clear();
+	linCols.clear();
+	linVals.clear();
+	buildJacobian();
+	for (uint32_t r : jacRegs) {
+		if (!isLiteral[r]) {
+			return false;
+		}
+	}
+
+	const size_t n = outputs.size();
+	linRows.push_back(0);
+	for (size_t i = 0; i < n; i += 1) {
+		for (size_t k = jacRows[i]; k < jacRows[i + 1]; k += 1) {
+			if (jacCols[k] < n) {
+				linCols.push_back(jacCols[k]);
+				linVals.push_back((outRho[i] != 0.0) ? regs[jacRegs[k]] / outRho[i] : regs[jacRegs[k]]);
+			}
+		}
+		linRows.push_back(linCols.size());
+	}
+	linOffset.assign(n, 0.0);
+	linReads = globalsRead();
+	linSeen.assign(linReads.size(), 0.0);
+	linStale = true;
+	linear = true;
+	return true;
+}
+
+/*
+*		b of an affine system, the right hand side with the integrated vars at
+*		zero. It is only evaluated again when a global it reads has changed
+*/
+const std::vector<double>& SystemCode::offset(const EvalContext& ctx) {
+	const double* globals = ctx.globals->value.data();
+	for (size_t k = 0; k < linReads.size(); k += 1) {
+		if (globals[linReads[k]] != linSeen[k]) {
+			linSeen[k] = globals[linReads[k]];
+			linStale = true;
+		}
+	}
+	if (linStale) {
+		linLocals = ctx.locals.value;
+		std::fill(linLocals.begin(), linLocals.begin() + outputs.size(), 0.0);
+		execCode(code.data(), rhsEnd, regs.data(), ctx.constants.value.data(), linLocals.data(), globals);
+		outputsTo(linOffset);
+		linStale = false;
+	}
+	return linOffset;
+}
+
+/*
+*		Evaluate the right hand side and its Jacobian, jac gets the entries of the
+*		sparsity pattern. buildJacobian has to be called first
+*/
+void SystemCode::runJacobian(const EvalContext& ctx, std::vector<double>& dxdt, std::vector<double>& jac) {
+	exec(code.size(), ctx);
+	outputsTo(dxdt);
+	jac.resize(jacCols.size());
+	for (size_t i = 0; i + 1 < jacRows.size(); i += 1) {
+		for (size_t k = jacRows[i]; k < jacRows[i + 1]; k += 1) {
+			jac[k] = (outRho[i] != 0.0) ? regs[jacRegs[k]] / outRho[i] : regs[jacRegs[k]];
+		}
+	}
+}
+
+/*
+*		Operations on one block of BATCHLANES lanes, the fixed trip count lets
+*		the compiler turn each loop into a few vector instructions
+*/
+static inline void copyLanes(double* __restrict d, const double* __restrict a) {
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		d[j] = a[j];
+	}
+}
+
+static inline void scaleLanes(double* __restrict d, const double* __restrict a, double rho, double delta) {
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		d[j] = (a[j] / rho) + delta;
+	}
+}
+
+static inline void addLanes(double* __restrict d, const double* __restrict a, const double* __restrict b) {
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		d[j] = a[j] + b[j];
+	}
+}
+
+static inline void subLanes(double* __restrict d, const double* __restrict a, const double* __restrict b) {
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		d[j] = a[j] - b[j];
+	}
+}
+
+static inline void mulLanes(double* __restrict d, const double* __restrict a, const double* __restrict b) {
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		d[j] = a[j] * b[j];
+	}
+}
+
+static inline bool divLanes(double* __restrict d, const double* __restrict a, const double* __restrict b) {
+	bool zero = false;
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		zero |= (b[j] == 0.0);
+	}
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		d[j] = a[j] / b[j];
+	}
+	return !zero;
+}
+
+static inline bool waveRange(const double* __restrict a) {
+	bool in = true;
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		in &= (std::fabs(a[j]) <= WAVERANGE);
+	}
+	return in;
+}
+
+/*
+*		sin of the lanes with quarter 0, cos with quarter 1. The argument is
+*		reduced by the nearest multiple n of pi/2 with pi/2 split in parts of 33
+*		bits, so the products with n are exact for |n| < 2^20 and the reduced
+*		argument is kept as a sum of two doubles. The kernels of fdlibm then give
+*		sin or cos of it by the quadrant of n + quarter, picked with masks so the
+*		loop has no branch. The result is within 1 ulp of libm for |x| up to
+*		WAVERANGE, the caller sends larger, infinite or NaN lanes to libm
+*/
+__attribute__((always_inline))
+static inline void waveLanes(double* __restrict d, const double* __restrict a, uint64_t quarter) {
+	const double invPio2 = 6.36619772367581382433e-01;
+	const double pio2_1 = 1.57079632673412561417e+00;
+	const double pio2_2 = 6.07710050630396597660e-11;
+	const double pio2_3 = 2.02226624871116645580e-21;
+	const double pio2_3t = 8.47842766036889956997e-32;
+	const double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03,
+							 S3 = -1.98412698298579493134e-04, S4 = 2.75573137070700676789e-06,
+							 S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+	const double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03,
+							 C3 = 2.48015872894767294178e-05, C4 = -2.75573143513906633035e-07,
+							 C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+	//adding 1.5 * 2^52 rounds to an integer which is left in the low bits
+	const double round = 0x1.8p52;
+
+	for (size_t j = 0; j < BATCHLANES; j += 1) {
+		const double x = a[j];
+		const double shifted = x * invPio2 + round;
+		uint64_t n;
+		std::memcpy(&n, &shifted, sizeof(n));
+		const double fn = shifted - round;
+
+		//x - fn * pi/2 as hi + lo, the rounding error of every difference kept
+		const double r1 = x - fn * pio2_1;
+		const double w2 = fn * pio2_2;
+		const double t = r1 - w2;
+		const double t2 = t - r1;
+		const double e2 = (r1 - (t - t2)) + (-w2 - t2);
+		const double w3 = fn * pio2_3;
+		const double u = t - w3;
+		const double u2 = u - t;
+		const double e3 = (t - (u - u2)) + (-w3 - u2);
+		const double tail = (e2 + e3) - fn * pio2_3t;
+		const double hi = u + tail;
+		const double lo = (u - hi) + tail;
+
+		const double z = hi * hi;
+		const double w = z * z;
+		const double v = z * hi;
+		const double rs = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+		const double s = hi - ((z * (0.5 * lo - v * rs) - lo) - v * S1);
+		const double rc = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+		const double hz = 0.5 * z;
+		const double c1 = 1.0 - hz;
+		const double c = c1 + (((1.0 - c1) - hz) + (z * rc - hi * lo));
+
+		const uint64_t q = n + quarter;
+		uint64_t sb;
+		uint64_t cb;
+		std::memcpy(&sb, &s, sizeof(sb));
+		std::memcpy(&cb, &c, sizeof(cb));
+		const uint64_t odd = 0 - (q & 1);
+		const uint64_t r = ((cb & odd) | (sb & ~odd)) ^ ((q & 2) << 62);
+		std::memcpy(d + j, &r, sizeof(r));
+	}
+}
+
+/*
+*		Run the DAG over n lanes, register r of lane j is at regs[r * n + j].
+*		A clone is built for every instruction set listed and the best one the
+*		processor supports is picked when the program is loaded. sin and cos of
+*		a block with an argument beyond WAVERANGE go through libm lane by lane
+*/
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void runLanes(const DagInstr* code, size_t count, double* regs, size_t n,
+										 const double* constants, const double* locals, const double* globals) {
+	for (size_t i = 0; i < count; i += 1) {
+		const DagInstr& in = code[i];
+		double* d = regs + in.dst * n;
+		const double* a = regs + in.a * n;
+		const double* b = regs + in.b * n;
+		for (size_t l = 0; l < n; l += BATCHLANES) {
+			switch (in.op) {
+			case OpCode::LOADC:
+				copyLanes(d + l, constants + in.a * n + l);
+				break;
+			case OpCode::LOADL:
+				copyLanes(d + l, locals + in.a * n + l);
+				break;
+			case OpCode::LOADG:
+				copyLanes(d + l, globals + in.a * n + l);
+				break;
+			case OpCode::LOADC_S:
+				scaleLanes(d + l, constants + in.a * n + l, in.x, in.y);
+				break;
+			case OpCode::LOADL_S:
+				scaleLanes(d + l, locals + in.a * n + l, in.x, in.y);
+				break;
+			case OpCode::LOADG_S:
+				scaleLanes(d + l, globals + in.a * n + l, in.x, in.y);
+				break;
+			case OpCode::ADD:
+				addLanes(d + l, a + l, b + l);
+				break;
+			case OpCode::SUB:
+				subLanes(d + l, a + l, b + l);
+				break;
+			case OpCode::MUL:
+				mulLanes(d + l, a + l, b + l);
+				break;
+			case OpCode::DIV:
+				if (!divLanes(d + l, a + l, b + l)) {
+					throw std::invalid_argument("Division by 0 not possible\n");
+				}
+				break;
+			case OpCode::SIN:
+				if (waveRange(a + l)) {
+					waveLanes(d + l, a + l, 0);
+					break;
+				}
+				for (size_t j = l; j < l + BATCHLANES; j += 1) {
+					d[j] = std::sin(a[j]);
+				}
+				break;
+			case OpCode::COS:
+				if (waveRange(a + l)) {
+					waveLanes(d + l, a + l, 1);
+					break;
+				}
+				for (size_t j = l; j < l + BATCHLANES; j += 1) {
+					d[j] = std::cos(a[j]);
+				}
+				break;
+			case OpCode::FAIL:
+				if (in.a == VARNOTFOUND) {
+					throw std::invalid_argument("Variable not found\n");
+				}
+				throw std::invalid_argument("Operation not found\n");
+			default:
+				break;
+			}
+		}
+	}
+}
+
+/*
+*		sin (oper s) or cos of n values the way runBatch takes them, n is a
+*		multiple of BATCHLANES
+*/
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void SystemCode::runWave(char oper, const double* a, double* d, size_t n) {
+	for (size_t l = 0; l < n; l += BATCHLANES) {
+		if (waveRange(a + l)) {
+			waveLanes(d + l, a + l, oper == 's' ? 0 : 1);
+			continue;
+		}
+		for (size_t j = l; j < l + BATCHLANES; j += 1) {
+			d[j] = (oper == 's') ? std::sin(a[j]) : std::cos(a[j]);
+		}
+	}
+}
+
+/*
+*		Evaluate every expression of the system for all lanes of the context,
+*		dxdt has to hold ctx.lanes entries per expression, expression major
+*/
+void SystemCode::runBatch(const BatchContext& ctx, std::vector<double>& dxdt) {
+	const size_t n = ctx.lanes;
+	if (batchLanes != n) {
+		batchRegs.assign(regs.size() * n, 0.0);
+		for (size_t i = 0; i < regs.size(); i += 1) {
+			if (isLiteral[i]) {
+				std::fill(batchRegs.begin() + i * n, batchRegs.begin() + (i + 1) * n, regs[i]);
+			}
+		}
+		batchLanes = n;
+	}
+
+	runLanes(code.data(), rhsEnd, batchRegs.data(), n,
+					 ctx.constants.data(), ctx.locals.data(), ctx.globals->data());
+
+	for (size_t i = 0; i < outputs.size(); i += 1) {
+		const double* r = batchRegs.data() + outputs[i] * n;
+		double* out = dxdt.data() + i * n;
+		if (outRho[i] != 0.0) {
+			for (size_t j = 0; j < n; j += 1) {
+				out[j] = (r[j] - outDelta[i]) / outRho[i];
+			}
+		}
+		else {
+			std::copy(r, r + n, out);
+		}
+	}
+}
+
+/*
+*		Spell a double so the generated code reads back exactly the same bits
+*/
+static std::string exact(double v) {
+	char buf[64];
+	if (std::isfinite(v)) {
+		std::snprintf(buf, sizeof(buf), "%a", v);
+	}
+	else {
+		uint64_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		std::snprintf(buf, sizeof(buf), "bits(0x%llxULL)", static_cast<unsigned long long>(bits));
+	}
+	return buf;
+}
+
+/*
+*		Write the DAG as a C++ function fn(locals, globals, dxdt) computing the
+*		same operations in the same order as run. It returns 0, or the error
+*		run would have raised: 1 division by 0, 2 variable not found,
+*		3 operation not found
+*/
+void SystemCode::emitSource(std::ostream& os, const std::string& fn) const {
+	os << "extern \"C\" int " << fn << "(const double* l, const double* g, double* dxdt) {\n";
+	for (size_t i = 0; i < regs.size(); i += 1) {
+		if (isLiteral[i]) {
+			os << "\tconst double r" << i << " = " << exact(regs[i]) << ";\n";
+		}
+	}
+	for (size_t i = 0; i < rhsEnd; i += 1) {
+		const DagInstr& in = code[i];
+		std::string d = "\tconst double r" + std::to_string(in.dst) + " = ";
+		std::string a = "r" + std::to_string(in.a);
+		std::string b = "r" + std::to_string(in.b);
+		switch (in.op) {
+		case OpCode::LOADL:
+			os << d << "l[" << in.a << "];\n";
+			break;
+		case OpCode::LOADG:
+			os << d << "g[" << in.a << "];\n";
+			break;
+		case OpCode::LOADL_S:
+			os << d << "(l[" << in.a << "] / " << exact(in.x) << ") + " << exact(in.y) << ";\n";
+			break;
+		case OpCode::LOADG_S:
+			os << d << "(g[" << in.a << "] / " << exact(in.x) << ") + " << exact(in.y) << ";\n";
+			break;
+		case OpCode::ADD:
+			os << d << a << " + " << b << ";\n";
+			break;
+		case OpCode::SUB:
+			os << d << a << " - " << b << ";\n";
+			break;
+		case OpCode::MUL:
+			os << d << a << " * " << b << ";\n";
+			break;
+		case OpCode::DIV:
+			os << "\tif (" << b << " == 0.0) return 1;\n";
+			os << d << a << " / " << b << ";\n";
+			break;
+		case OpCode::SIN:
+			os << d << "std::sin(" << a << ");\n";
+			break;
+		case OpCode::COS:
+			os << d << "std::cos(" << a << ");\n";
+			break;
+		case OpCode::FAIL:
+			os << "\treturn " << (in.a == VARNOTFOUND ? 2 : 3) << ";\n";
+			os << "\tconst double r" << in.dst << " = 0.0;\n";
+			break;
+		default:
+			break;
+		}
+	}
+	for (size_t i = 0; i < outputs.size(); i += 1) {
+		if (outRho[i] != 0.0) {
+			os << "\tdxdt[" << i << "] = (r" << outputs[i] << " - " << exact(outDelta[i]) << ") / "
+				 << exact(outRho[i]) << ";\n";
+		}
+		else {
+			os << "\tdxdt[" << i << "] = r" << outputs[i] << ";\n";
+		}
+	}
+	os << "\treturn 0;\n}\n";
+}
@@ -0,0 +1,198 @@
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+#include "include/threadPool.h"
+
+//the pool and queue of the worker running on this thread
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local size_t currentQueue = 0;
+
+ThreadPool::ThreadPool(size_t threads) : pending(0), active(0), failed(false), stop(false) {
+	size_t n = threads > 1 ? threads - 1 : 0;
+	for (size_t i = 0; i < n + 1; i += 1) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+	for (size_t i = 0; i < n; i += 1) {
+		workers.emplace_back(&ThreadPool::work, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stop = true;
+	}
+	cv.notify_all();
+	for (auto& t : workers) {
+		t.join();
+	}
+}
+
+size_t ThreadPool::self() const {
+	return currentPool == this ? currentQueue : queues.size() - 1;
+}
+
+/*
+*		Queue a task on the deque of the calling worker, so the tasks a task
+*		spawns stay on its thread unless another one is idle
+*/
+void ThreadPool::submit(std::function<void()> task) {
+	Queue& q = *queues[self()];
+	{
+		std::lock_guard<std::mutex> lock(q.m);
+		q.tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> lock(m);
+		pending += 1;
+	}
+	cv.notify_one();
+}
+
+/*
+*		Take the newest task of queue q, or steal the oldest one of another queue
+*/
+bool ThreadPool::take(size_t q, std::function<void()>& task) {
+	if (pending == 0) {
+		return false;
+	}
+	for (size_t k = 0; k < queues.size(); k += 1) {
+		Queue& other = *queues[(q + k) % queues.size()];
+		std::lock_guard<std::mutex> lock(other.m);
+		if (!other.tasks.empty()) {
+			if (k == 0) {
+				task = std::move(other.tasks.back());
+				other.tasks.pop_back();
+			}
+			else {
+				task = std::move(other.tasks.front());
+				other.tasks.pop_front();
+			}
+			pending -= 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+*		Run a task, the first exception a task throws is kept for runUntil
+*/
+void ThreadPool::runTask(std::function<void()>& task) {
+	active += 1;
+	try {
+		task();
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(m);
+		if (!error) {
+			error = std::current_exception();
+		}
+		failed = true;
+	}
+	task = nullptr;
+	active -= 1;
+	if (failed) {
+		std::lock_guard<std::mutex> lock(m);
+		cv.notify_all();
+	}
+}
+
+void ThreadPool::work(size_t q) {
+	currentPool = this;
+	currentQueue = q;
+	std::function<void()> task;
+	for (;;) {
+		if (take(q, task)) {
+			runTask(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m);
+		cv.wait(lock, [&]() {
+			return stop || pending > 0;
+		});
+		if (stop) {
+			return;
+		}
+	}
+}
+
+/*
+*		Run tasks on the calling thread until done holds, done is checked again
+*		whenever a task calls wake. When a task failed and no task runs anymore
+*		its exception is rethrown, which only happens outside of the tasks
+*/
+void ThreadPool::runUntil(const std::function<bool()>& done) {
+	size_t q = self();
+	std::function<void()> task;
+	for (;;) {
+		if (take(q, task)) {
+			runTask(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m);
+		if (done()) {
+			return;
+		}
+		if (failed && active == 0) {
+			std::rethrow_exception(error);
+		}
+		cv.wait(lock, [&]() {
+			return pending > 0 || (failed && active == 0) || done();
+		});
+	}
+}
+
+/*
+*		Run body(0) to body(n - 1) on the pool and wait for them, the calling
+*		thread runs body(0) and then helps. Rethrows the first exception of a body
+*/
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)>& body) {
+	std::atomic<size_t> left(n);
+	std::mutex em;
+	std::exception_ptr e;
+	auto run = [&](size_t k) {
+		try {
+			body(k);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(em);
+			if (!e) {
+				e = std::current_exception();
+			}
+		}
+		//the caller may return as soon as left is 0, so nothing of it is used after
+		ThreadPool* pool = this;
+		if (--left == 0) {
+			pool->wake();
+		}
+	};
+	for (size_t k = 1; k < n; k += 1) {
+		submit([&run, k]() {
+			run(k);
+		});
+	}
+	if (n > 0) {
+		run(0);
+	}
+	runUntil([&]() {
+		return left == 0;
+	});
+	if (e) {
+		std::rethrow_exception(e);
+	}
+}
+
+bool ThreadPool::hasFailed() const {
+	return failed;
+}
+
+void ThreadPool::wake() {
+	std::lock_guard<std::mutex> lock(m);
+	cv.notify_all();
+}